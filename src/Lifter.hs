@@ -1,19 +1,17 @@
 module Main where
 
-import Blaze.ByteString.Builder (Builder, toByteStringIO)
-import Blaze.ByteString.Builder.Char8 (fromChar)
-import Control.Concurrent (ThreadId, killThread, myThreadId, threadDelay)
+import Control.Concurrent (forkIO, threadDelay)
 import Control.Concurrent.MVar (MVar, modifyMVar_, newMVar, takeMVar)
-import Control.Monad (forM_, sequence, when)
+import Control.Monad (when)
 import qualified Data.ByteString.Char8 as B
-import Data.List (sort, sortBy, zip4)
-import Data.Monoid (mappend, mempty)
--- import System.Posix.Signals (Handler(Catch), installHandler, sigINT)
+import Data.List (sort)
+import Data.Time.Clock (UTCTime, addUTCTime, getCurrentTime)
 import System.Environment (getArgs)
-import System.IO (hPutStrLn, hPutStr, stderr)
-import System.IO (hPrint)
+import System.Exit (ExitCode(ExitSuccess))
+import System.IO (hFlush, hPutStr, stderr, stdout)
+import System.Posix.Process (exitImmediately)
+import System.Posix.Signals (Handler(Catch), installHandler, sigINT)
 import System.Random (newStdGen, randomRs)
-import qualified Data.Map as M
 import VM
 import Utils
 
@@ -23,6 +21,15 @@ cMAX = 2147483647
 
 maxSteps = 5000
 
+-- nodes expanded by the parallel best-first search
+searchNodes = 100000
+
+-- states kept to search from, the worst going first when there are more
+maxFrontierSize = 5000
+
+-- seconds to search for, unless interrupted sooner
+defaultTimeLimit = 140 :: Double
+
 myPrint c x =
     let str = if x ==  cMAX then "X" else show x in
     let str2 = if c then "\n" else "" in
@@ -55,17 +62,9 @@ findA s c r p =
       let (t, goal) = chooseGoal s c p (getWorldSize s) r in
       if t /= ORobot then findPath s c r goal else []
 
--- checks if the moves kills the robot
-testMoves s m =
-    let s' = makeMoves s m in
-    if (getCondition s') /= CLose then (True, s') else (False, s)
-
--- finds the moves that do not kill robot
-testMovesList _ s _ [] l = l
-testMovesList steps s prefix (m:ms) l =
-   let (b, s') = testMoves s m in
-   let goodMoves = if b then l ++ [(s', steps, prefix++m)] else l in
-   testMovesList steps s prefix ms goodMoves
+-- finds the moves that do not kill robot, trying them all in one go
+testMovesList steps s prefix moves =
+   [(s', steps, extendHistory prefix m) | (m, (_, _, _, Just s')) <- zip moves (evaluateCandidates s (/= CLose) moves)]
 
 -- to complicated
 myFind _ [] = []
@@ -74,6 +73,10 @@ myFind g ((p, m):xs) = if p==g then [m] else myFind g xs
 getSomePossibilities s c r p m steps = all ++ [[m]]
    where
 -- several sequences of moves
+      -- follow the planned tour to its first stop we can reach
+      movesTour = case filter (\fp -> getCost c fp < cMAX) (buildTour s) of
+                    (goal : _) -> findPath s c r goal
+                    [] -> []
       --find lambda!
       moves = findA s c r (\(_, _, fp) -> isLambda s fp || isLift s fp)
       -- probably wrong, but i am too tired / jmi
@@ -89,91 +92,109 @@ getSomePossibilities s c r p m steps = all ++ [[m]]
       -- find earth!
       moves3 = findA s c r (\(_, _, fp) -> isEarth s fp)
       -- small probability of doing nothing
-      all = if p then [] else [moves, moves2, movesComak, moves3]
+      all = if p then [] else [movesTour, moves, moves2, movesComak, moves3]
 
 -- run :: MVar Builder -> State -> [Move] -> [Int] -> IO (Int, [Move])
 -- main function
-goDijkstra (p:ps) (m:ms) queue (bestScore, bestMoves) (s,steps,prefix)  = do
+goDijkstra frontier (p:ps) (m:ms) (bestScore, bestMoves) (s,steps,prefix)  = do
       let r = getRobotPoint s
       let c = buildCostTable s r
       printCT c s
       let possibilities = filter (\x -> x /= [])  $ getSomePossibilities s c r p m steps
       let steps' = if length(possibilities) <= 1 then steps+20 else steps+1
       let moves = if possibilities == [] || steps<1000 then possibilities ++ [[MRight], [MLeft], [MDown], [MUp]] else possibilities
-      let tMoves = testMovesList steps s prefix moves []
+      let tMoves = testMovesList steps s prefix moves
       if moves == []
-          then return ((0, [MAbort]), queue)
+          then return (0, extendHistory emptyHistory [MAbort])
           else
-              let ((s', _, result):answers) =  testMovesList steps s prefix moves [] in
+              let ((s', _, result):answers) = tMoves in
               let score = getScore s' in
               let topMoves = if bestScore>score then (bestScore, bestMoves) else (score , result) in
       --      dump s'
-              if  (getCondition s')/= CNone || steps' > maxSteps
-                 then return (topMoves, queue)
-                 else goDijkstra ps ms  (queue ++ answers) topMoves (s',steps', result)
-
--- mietek's function
-handleInterrupt :: MVar Builder -> ThreadId -> IO ()
-handleInterrupt resultV mainT = do
-  result <- takeMVar resultV
-  toByteStringIO B.putStrLn result
-  killThread mainT
-
--- <<<<<<< HEAD
--- refine :: [(State, Int, [Move])] -> [(State, Int, [Move])]
--- refine x = take maxSteps $ sortBy (\(s1, _, m1) -> (
---                        \(s2, _, m2) -> (
---                           if (getScore s1)-(length m1) < (getScore s2)+(length m2) then LT else GT
---                    ))) x
--- =======
-refine :: [(State,Int,[Move])] -> [(State,Int,[Move])]
-refine = map getMin . M.elems . atSamePos where
-    atSamePos = foldr (\ a@(st,x,ms) acc ->
-                           let cpos = getRobotPoint st
-                           in if cpos `M.member` acc
-                               then M.update (Just .(a:)) cpos acc
-                              else M.insert cpos [a] acc) M.empty
-    getMin = head . sortBy criterium
-    criterium (st1,_,ms1) (st2,_,ms2)
-        | getScore st1 >= 20 + getScore st2 = LT
-        | getBlockedLambdas st1 < getBlockedLambdas st2 = LT
-        | length ms1 < length ms2 = LT
-        | getRobotHealt st1 >= getRobotHealt st2 = LT
-        | otherwise = GT
-
-
--- initialize random values
-prepareRun :: Int -> Int -> [(State, Int, [Move])] -> [(Int, [Move])] -> IO [(Int, [Move])]
-prepareRun _ _ [] results = do return results
-prepareRun d n (x:xs) previousResults = do
-  seed <- newStdGen
-  let ms  = map f $ randomRs (1, 5) seed
-  let ps  = map (\x -> x == 1) $ randomRs (1, n) seed
-  (result, rest) <- goDijkstra ps ms [] (0, [MAbort]) x
-  let rest' = refine $ xs ++ rest
---  print $ length rest'
-  if d == 0 || rest' == []
-      then return $ result:previousResults
-      else prepareRun (d-1) n rest' $ result:previousResults
-
-data Verbosity = MoveSequence | Dump deriving (Eq, Ord, Show)
+              if  (getCondition s')/= CNone || steps' > maxSteps || getScoreBound s' <= fst topMoves
+                 then return topMoves
+                 else do
+                   pushAll frontier answers
+                   goDijkstra frontier ps ms topMoves (s',steps', result)
+
+-- The best score and moves found so far.  Moves are forced before they are
+-- published, so that printing them takes no time.
+type Result = MVar (Int, [Move])
+
+publish :: Result -> (Int, [Move]) -> IO ()
+publish resultV (score, moves) =
+  foldr seq () moves `seq`
+    modifyMVar_ resultV (\best@(bestScore, _) ->
+      return $! if score > bestScore then (score, moves) else best)
+
+-- Prints the best moves, caches them and exits.  Called at most once: whoever
+-- takes the result first, between SIGINT, the deadline and the end of the
+-- search, prints it, and the others block until the process is gone.
+finish :: Bool -> State -> Result -> IO ()
+finish verbose input resultV = do
+  (_, moves) <- takeMVar resultV
+  when verbose $
+    dump $ makeMoves input moves
+  putStrLn (map fromMove moves)
+  hFlush stdout
+  saveSolution input "lifter" moves
+  exitImmediately ExitSuccess
+
+-- Queues states to search from, best score first.
+pushAll :: Frontier -> [(State, Int, History)] -> IO ()
+pushAll frontier = mapM_ (\x@(s, _, _) -> pushFrontier frontier (getScore s) x)
+
+
+-- initialize random values, publishing every run, until the deadline passes
+-- or no state is left to search from
+prepareRun :: Result -> UTCTime -> Int -> Int -> Frontier -> IO ()
+prepareRun resultV deadline d n frontier = do
+  next <- popFrontier frontier
+  case next of
+    Nothing -> return ()
+    Just x -> do
+      seed <- newStdGen
+      let ms  = map f $ randomRs (1, 5) seed
+      let ps  = map (\x -> x == 1) $ randomRs (1, n) seed
+      (score, result) <- goDijkstra frontier ps ms (0, extendHistory emptyHistory [MAbort]) x
+      publish resultV (score, historyMoves result)
+      now <- getCurrentTime
+      if d == 0 || now >= deadline
+          then return ()
+          else prepareRun resultV deadline (d-1) n frontier
+
+-- States a quarter, half and three quarters of the way along cached moves, so
+-- that some runs start from where the best known solution got to.
+warmStart :: State -> [Move] -> [(State, Int, History)]
+warmStart input moves =
+  [(makeMoves input ms, length ms, extendHistory emptyHistory ms) | k <- [3, 2, 1], let ms = take (k * length moves' `div` 4) moves']
+  where moves' = filter (/= MAbort) moves
+
+parseArgs :: [String] -> (Bool, Double)
+parseArgs = parse (False, defaultTimeLimit)
+  where
+    parse (_, t) ("-v" : args) = parse (True, t) args
+    parse (v, _) ("-t" : t : args) = parse (v, read t) args
+    parse o _ = o
 
 main :: IO ()
 main = do
---  resultV <- newMVar mempty
---  mainT <- myThreadId
---  _ <- installHandler sigINT (Catch (handleInterrupt resultV mainT)) Nothing
+  args <- getArgs
+  let (verbose, timeLimit) = parseArgs args
+  start <- getCurrentTime
+  let deadline = addUTCTime (realToFrac timeLimit) start
   rawInput <- B.getContents
   let input = new rawInput
---  let runs = [prepareRun i input | i<-([1..400]::[Int])]
-  runs <- prepareRun 5000 500 [(input, 0, [])] []
-  -- TODO: Store results one by one in resultV
-  let results = sortBy (flip compare) runs
-  let (_, maxMoves) = head results
-  -- TODO: Output using Builder/ByteString
-  args <- getArgs
-  when (args == ["-v"]) $
---    forM_ results $ \(score, moves) ->
---      hPutStrLn stderr (show score ++ " " ++ map fromMove moves)
-	dump $ makeMoves input maxMoves
-  putStrLn (map fromMove maxMoves)
+  resultV <- newMVar (0, [MAbort])
+  _ <- installHandler sigINT (Catch (finish verbose input resultV)) Nothing
+  _ <- forkIO $ do
+    threadDelay (round (timeLimit * 1000000))
+    finish verbose input resultV
+  cached <- loadSolution input
+  mapM_ (publish resultV) cached
+  let searched = search input searchNodes
+  publish resultV (getScore (makeMoves input searched), searched)
+  frontier <- newFrontier input maxFrontierSize
+  pushAll frontier $ maybe [] (warmStart input . snd) cached ++ [(input, 0, emptyHistory)]
+  prepareRun resultV deadline 5000 500 frontier
+  finish verbose input resultV
@@ -3,14 +3,17 @@
 
 module VM where
 
+import Control.Monad (forM)
 import Data.ByteString (ByteString)
 import Data.ByteString.Unsafe (unsafeUseAsCStringLen)
-import Foreign.Ptr (Ptr)
-import Foreign.ForeignPtr (ForeignPtr, newForeignPtr, withForeignPtr)
-import Foreign.C.String (CString, castCharToCChar, castCCharToChar, withCString)
-import Foreign.C.Types (CChar (..), CLong (..))
-import Foreign.Marshal.Alloc (alloca, finalizerFree)
-import Foreign.Marshal.Utils (toBool)
+import Data.Word (Word)
+import Foreign.Ptr (FunPtr, Ptr, nullPtr)
+import Foreign.ForeignPtr (ForeignPtr, newForeignPtr, newForeignPtr_, withForeignPtr)
+import Foreign.C.String (CString, castCharToCChar, castCCharToChar, peekCString, withCString)
+import Foreign.C.Types (CChar (..), CDouble (..), CLong (..), CULong (..))
+import Foreign.Marshal.Alloc (alloca, finalizerFree, free)
+import Foreign.Marshal.Array (withArrayLen)
+import Foreign.Marshal.Utils (toBool, withMany)
 import Foreign.Storable (peek)
 import System.IO.Unsafe (unsafePerformIO)
 
@@ -169,6 +172,16 @@ fromMove MWait  = 'W'
 fromMove MAbort = 'A'
 fromMove MShave = 'S'
 
+toMove :: Char -> Move
+toMove 'L' = MLeft
+toMove 'R' = MRight
+toMove 'U' = MUp
+toMove 'D' = MDown
+toMove 'W' = MWait
+toMove 'A' = MAbort
+toMove 'S' = MShave
+toMove _ = undefined
+
 reverseMove :: Move -> Move
 reverseMove MLeft  = MRight
 reverseMove MRight = MLeft
@@ -269,6 +282,15 @@ foreign import ccall unsafe "libvm.h get_move_count"
 foreign import ccall unsafe "libvm.h get_score"
   cGetScore :: CStatePtr -> CLong
 
+foreign import ccall unsafe "libvm.h get_score_bound"
+  cGetScoreBound :: CStatePtr -> CLong
+
+foreign import ccall unsafe "libvm.h get_flooding_move_count"
+  cGetFloodingMoveCount :: CStatePtr -> CLong -> CLong
+
+foreign import ccall unsafe "libvm.h get_drowning_move_count"
+  cGetDrowningMoveCount :: CStatePtr -> CLong -> CLong -> CLong
+
 foreign import ccall unsafe "libvm.h get_condition"
   cGetCondition :: CStatePtr -> CChar
 
@@ -293,6 +315,15 @@ foreign import ccall unsafe "libvm.h is_enterable"
 foreign import ccall unsafe "libvm.h is_safe"
   cIsSafe :: CStatePtr -> CLong -> CLong -> CChar
 
+foreign import ccall unsafe "libvm.h is_stable"
+  cIsStable :: CStatePtr -> CLong -> CLong -> CChar
+
+foreign import ccall unsafe "libvm.h is_dead"
+  cIsDead :: CStatePtr -> CLong -> CLong -> CChar
+
+foreign import ccall unsafe "libvm.h get_component"
+  cGetComponent :: CStatePtr -> CLong -> CLong -> CLong
+
 
 new :: ByteString -> State
 new input =
@@ -406,6 +437,23 @@ getMoveCount = getInt cGetMoveCount
 getScore :: State -> Int
 getScore = getInt cGetScore
 
+-- No moves from the state score more than this.
+getScoreBound :: State -> Int
+getScoreBound = getInt cGetScoreBound
+
+-- The first move on which a robot in the given row is underwater, or maxBound.
+getFloodingMoveCount :: State -> Int -> Int
+getFloodingMoveCount s y =
+  unwrapState s $ \sp ->
+    return (fromEnum (cGetFloodingMoveCount sp (toEnum y)))
+
+-- The last move on which the robot may arrive at the point and still get out
+-- of the water, or maxBound.
+getDrowningMoveCount :: State -> Point -> Int
+getDrowningMoveCount s (x, y) =
+  unwrapState s $ \sp ->
+    return (fromEnum (cGetDrowningMoveCount sp (toEnum x) (toEnum y)))
+
 getCondition :: State -> Condition
 getCondition s =
   unwrapState s $ \sp ->
@@ -513,6 +561,21 @@ isSafe s (x, y) =
   unwrapState s $ \sp ->
     return (toBool (cIsSafe sp (toEnum x) (toEnum y)))
 
+isStable :: State -> Point -> Bool
+isStable s (x, y) =
+  unwrapState s $ \sp ->
+    return (toBool (cIsStable sp (toEnum x) (toEnum y)))
+
+isDead :: State -> Point -> Bool
+isDead s (x, y) =
+  unwrapState s $ \sp ->
+    return (toBool (cIsDead sp (toEnum x) (toEnum y)))
+
+getComponent :: State -> Point -> Int
+getComponent s (x, y) =
+  unwrapState s $ \sp ->
+    return (fromEnum (cGetComponent sp (toEnum x) (toEnum y)))
+
 
 data CCostTable
 type CCostTablePtr = Ptr CCostTable
@@ -550,3 +613,267 @@ getDist (CostTable ctfp) (x, y) =
   unsafePerformIO $
     withForeignPtr ctfp $ \ctp ->
       return (fromEnum (cGetDist ctp (toEnum x) (toEnum y)))
+
+
+data CTour
+type CTourPtr = Ptr CTour
+
+
+foreign import ccall unsafe "tour.h build_tour"
+  cBuildTour :: CStatePtr -> CLong -> IO CTourPtr
+
+foreign import ccall unsafe "tour.h get_tour_length"
+  cGetTourLength :: CTourPtr -> CLong
+
+foreign import ccall unsafe "tour.h get_tour_point"
+  cGetTourPoint :: CTourPtr -> CLong -> Ptr CLong -> Ptr CLong -> IO ()
+
+
+-- The order in which to visit the lambdas (and razors, on maps with beards),
+-- ending with the lift.  Uses every online CPU.
+buildTour :: State -> [Point]
+buildTour s =
+  unwrapState s $ \sp -> do
+    tp <- cBuildTour sp 0
+    points <- forM [0 .. cGetTourLength tp - 1] $ \i ->
+      alloca $ \xp ->
+        alloca $ \yp -> do
+          cGetTourPoint tp i xp yp
+          x <- peek xp
+          y <- peek yp
+          return (fromEnum x, fromEnum y)
+    free tp
+    return points
+
+
+foreign import ccall safe "search.h search"
+  cSearch :: CStatePtr -> CLong -> CLong -> Ptr CLong -> IO CString
+
+
+-- The moves to the best state found by a parallel best-first search that
+-- expands at most the given number of nodes.  Uses every online CPU.
+search :: State -> Int -> [Move]
+search s maxNodeCount =
+  unwrapState s $ \sp -> do
+    cs <- cSearch sp 0 (toEnum maxNodeCount) nullPtr
+    moves <- peekCString cs
+    free cs
+    return (map toMove moves)
+
+
+foreign import ccall safe "optimize.h optimize"
+  cOptimize :: CStatePtr -> CString -> CLong -> CDouble -> Ptr CLong -> IO CString
+
+
+-- Moves scoring at least as well as the given ones, found by editing them for
+-- the given number of seconds.  Uses every online CPU.
+optimize :: State -> [Move] -> Double -> [Move]
+optimize s moves timeLimit =
+  unwrapState s $ \sp ->
+    withCString (map fromMove moves) $ \ms -> do
+      cs <- cOptimize sp ms 0 (realToFrac timeLimit) nullPtr
+      moves' <- peekCString cs
+      free cs
+      return (map toMove moves')
+
+
+foreign import ccall safe "trace.h write_trace"
+  cWriteTrace :: CString -> CStatePtr -> CString -> IO ()
+
+
+-- Writes a binary trace of the initial state and the state after each move,
+-- until a move leaves the state unchanged, as a compact -vvv.
+writeTrace :: String -> State -> String -> IO ()
+writeTrace path (State sfp0) moves =
+  withCString path $ \p ->
+    withCString moves $ \ms ->
+      withForeignPtr sfp0 $ \sp0 ->
+        cWriteTrace p sp0 ms
+
+
+foreign import ccall unsafe "cache.h load_solution"
+  cLoadSolution :: CStatePtr -> Ptr CLong -> IO CString
+
+foreign import ccall unsafe "cache.h save_solution"
+  cSaveSolution :: CStatePtr -> CString -> CString -> IO ()
+
+
+-- The score and moves cached for the map the state starts, checked against
+-- libvm, if any.
+loadSolution :: State -> IO (Maybe (Int, [Move]))
+loadSolution (State sfp0) =
+  withForeignPtr sfp0 $ \sp0 ->
+    alloca $ \scorep -> do
+      cs <- cLoadSolution sp0 scorep
+      if cs == nullPtr
+        then return Nothing
+        else do
+          score <- peek scorep
+          moves <- peekCString cs
+          free cs
+          return $ Just (fromEnum score, map toMove moves)
+
+-- Caches the moves for the map the state starts, unless they score no better
+-- than those cached already.  The second argument says what found them.
+saveSolution :: State -> String -> [Move] -> IO ()
+saveSolution (State sfp0) foundBy moves =
+  withCString foundBy $ \fb ->
+    withCString (map fromMove moves) $ \ms ->
+      withForeignPtr sfp0 $ \sp0 ->
+        cSaveSolution sp0 ms fb
+
+
+data CHistory
+type CHistoryPtr = Ptr CHistory
+data History = History !(ForeignPtr CHistory)
+
+foreign import ccall unsafe "history.h extend_history"
+  cExtendHistory :: CHistoryPtr -> CString -> IO CHistoryPtr
+
+foreign import ccall unsafe "history.h &release_history"
+  cReleaseHistory :: FunPtr (CHistoryPtr -> IO ())
+
+foreign import ccall unsafe "history.h get_history_length"
+  cGetHistoryLength :: CHistoryPtr -> CLong
+
+foreign import ccall unsafe "history.h get_history_moves"
+  cGetHistoryMoves :: CHistoryPtr -> IO CString
+
+
+-- Moves kept in libvm as a chunk on top of the history before them, which is
+-- shared rather than copied, so extending a history takes time in proportion
+-- to the moves added only.
+emptyHistory :: History
+emptyHistory = unsafePerformIO $ do
+  hfp <- newForeignPtr_ nullPtr
+  return (History hfp)
+{-# NOINLINE emptyHistory #-}
+
+extendHistory :: History -> [Move] -> History
+extendHistory (History hfp) moves =
+  unsafePerformIO $
+    withForeignPtr hfp $ \hp ->
+      withCString (map fromMove moves) $ \ms -> do
+        hp' <- cExtendHistory hp ms
+        hfp' <- newForeignPtr cReleaseHistory hp'
+        return (History hfp')
+
+historyLength :: History -> Int
+historyLength (History hfp) =
+  unsafePerformIO $
+    withForeignPtr hfp $ \hp ->
+      return (fromEnum (cGetHistoryLength hp))
+
+historyMoves :: History -> [Move]
+historyMoves (History hfp) =
+  unsafePerformIO $
+    withForeignPtr hfp $ \hp -> do
+      cs <- cGetHistoryMoves hp
+      moves <- peekCString cs
+      free cs
+      return (map toMove moves)
+
+
+data CFrontier
+type CFrontierPtr = Ptr CFrontier
+data Frontier = Frontier !(ForeignPtr CFrontier)
+
+foreign import ccall unsafe "frontier.h new_frontier"
+  cNewFrontier :: CStatePtr -> CLong -> CLong -> IO CFrontierPtr
+
+foreign import ccall unsafe "frontier.h &free_frontier"
+  cFreeFrontier :: FunPtr (CFrontierPtr -> IO ())
+
+foreign import ccall unsafe "frontier.h push_frontier"
+  cPushFrontier :: CFrontierPtr -> CStatePtr -> CLong -> CLong -> CHistoryPtr -> IO CChar
+
+foreign import ccall unsafe "frontier.h pop_frontier"
+  cPopFrontier :: CFrontierPtr -> Ptr CLong -> Ptr CLong -> Ptr CHistoryPtr -> IO CStatePtr
+
+foreign import ccall unsafe "frontier.h get_frontier_size"
+  cGetFrontierSize :: CFrontierPtr -> IO CLong
+
+
+-- States waiting to be searched from, with the number of steps taken and the
+-- moves to each, kept in libvm in order of a key.  Holds at most the given
+-- number of states, evicting the lowest key when full, and counts states that
+-- hash the same as one.
+newFrontier :: State -> Int -> IO Frontier
+newFrontier (State sfp0) maxEntryCount =
+  withForeignPtr sfp0 $ \sp0 -> do
+    fp <- cNewFrontier sp0 (toEnum maxEntryCount) 0
+    ffp <- newForeignPtr cFreeFrontier fp
+    return (Frontier ffp)
+
+-- Returns whether the state went in, with the key given.
+pushFrontier :: Frontier -> Int -> (State, Int, History) -> IO Bool
+pushFrontier (Frontier ffp) key (State sfp, steps, History hfp) =
+  withForeignPtr ffp $ \fp ->
+    withForeignPtr sfp $ \sp ->
+      withForeignPtr hfp $ \hp -> do
+        pushed <- cPushFrontier fp sp (toEnum key) (toEnum steps) hp
+        return (toBool pushed)
+
+-- Takes out the state with the highest key.
+popFrontier :: Frontier -> IO (Maybe (State, Int, History))
+popFrontier (Frontier ffp) =
+  withForeignPtr ffp $ \fp ->
+    alloca $ \keyp ->
+      alloca $ \stepsp ->
+        alloca $ \hpp -> do
+          sp <- cPopFrontier fp keyp stepsp hpp
+          if sp == nullPtr
+            then return Nothing
+            else do
+              s <- wrapState sp
+              steps <- peek stepsp
+              hp <- peek hpp
+              hfp <- if hp == nullPtr then newForeignPtr_ nullPtr else newForeignPtr cReleaseHistory hp
+              return $ Just (s, fromEnum steps, History hfp)
+
+frontierSize :: Frontier -> IO Int
+frontierSize (Frontier ffp) =
+  withForeignPtr ffp $ \fp -> do
+    size <- cGetFrontierSize fp
+    return (fromEnum size)
+
+
+data CBatch
+type CBatchPtr = Ptr CBatch
+
+foreign import ccall unsafe "batch.h evaluate_candidates"
+  cEvaluateCandidates :: CStatePtr -> Ptr CString -> CLong -> IO CBatchPtr
+
+foreign import ccall unsafe "batch.h get_batch_score"
+  cGetBatchScore :: CBatchPtr -> CLong -> IO CLong
+
+foreign import ccall unsafe "batch.h get_batch_condition"
+  cGetBatchCondition :: CBatchPtr -> CLong -> IO CChar
+
+foreign import ccall unsafe "batch.h get_batch_hash"
+  cGetBatchHash :: CBatchPtr -> CLong -> IO CULong
+
+foreign import ccall unsafe "batch.h get_batch_state"
+  cGetBatchState :: CBatchPtr -> CLong -> IO CStatePtr
+
+
+-- Makes each list of moves from the state, as makeMoves would, in one call
+-- to libvm.  Gives the score, condition and hash each ends with, and the
+-- state itself only where the condition passes the test.
+evaluateCandidates :: State -> (Condition -> Bool) -> [[Move]] -> [(Int, Condition, Word, Maybe State)]
+evaluateCandidates _ _ [] = []
+evaluateCandidates (State sfp0) keep movesList =
+  unsafePerformIO $
+    withForeignPtr sfp0 $ \sp0 ->
+      withMany withCString (map (map fromMove) movesList) $ \mss ->
+        withArrayLen mss $ \n msp -> do
+          bp <- cEvaluateCandidates sp0 msp (toEnum n)
+          results <- forM [0 .. toEnum n - 1] $ \k -> do
+            score <- cGetBatchScore bp k
+            condition <- cGetBatchCondition bp k
+            h <- cGetBatchHash bp k
+            let c = toCondition (castCCharToChar condition)
+            s <- if keep c then cGetBatchState bp k >>= fmap Just . wrapState else return Nothing
+            return (fromEnum score, c, fromIntegral h, s)
+          free bp
+          return results
@@ -34,4 +34,8 @@ main = do
     ["-v", path]   -> runWithFile Score path
     ["-vv", path]  -> runWithFile FinalDump path
     ["-vvv", path] -> runWithFile AllDumps path
-    _ -> putStrLn "Usage: echo <moves> | ./validator [-v|-vv|-vvv] <map>"
+    ["-t", tracePath, path] -> do
+      s0 <- newFromFile path
+      moves <- getContents
+      writeTrace tracePath s0 moves
+    _ -> putStrLn "Usage: echo <moves> | ./validator [-v|-vv|-vvv|-t <trace>] <map>"
@@ -0,0 +1,434 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "batch.h"
+
+
+#define SPLAT(c) ((batch_vector){0} + (signed char)(c))
+#define LOAD(p) (*(const batch_vector *)(p))
+#define STORE(p) (*(batch_vector *)(p))
+#define SELECT(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// All states must come from the same map.  The batch is one allocation, to be
+// freed with free().
+struct batch *new_batch(const struct state *const *s, long state_count) {
+    DEBUG_ASSERT(s && state_count > 0);
+    struct batch *b;
+    struct state *template;
+    long lane_count, cell_count, size, k, t, x, y;
+    char *data;
+    lane_count = (state_count + BATCH_VECTOR_SIZE - 1) / BATCH_VECTOR_SIZE * BATCH_VECTOR_SIZE;
+    cell_count = (s[0]->world_w + 2) * (s[0]->world_h + 3);
+    size = (sizeof(struct batch) + sizeof(struct state) + s[0]->world_length + 15) & ~15L;
+    size += 9 * lane_count * sizeof(long) + 6 * lane_count + 2 * cell_count * lane_count;
+    if (posix_memalign((void **)&b, BATCH_VECTOR_SIZE, size))
+        PERROR_EXIT("posix_memalign");
+    memset(b, 0, sizeof(struct batch));
+    b->state_count = state_count;
+    b->lane_count = lane_count;
+    b->world_w = s[0]->world_w;
+    b->world_h = s[0]->world_h;
+    b->padded_w = b->world_w + 2;
+    b->padded_h = b->world_h + 3;
+    data = (char *)b + sizeof(struct batch);
+    template = (struct state *)data;
+    memcpy(template, s[0], sizeof(struct state) + s[0]->world_length);
+    b->template = template;
+    data = (char *)b + ((sizeof(struct batch) + sizeof(struct state) + s[0]->world_length + 15) & ~15L);
+#define CARVE(field, type) \
+    do { \
+        b->field = (type *)data; \
+        data += lane_count * sizeof(type); \
+    } while (0)
+    CARVE(robot_p, long);
+    CARVE(water_level, long);
+    CARVE(used_robot_waterproofing, long);
+    CARVE(razor_count, long);
+    CARVE(collected_lambda_count, long);
+    CARVE(move_count, long);
+    CARVE(score, long);
+    CARVE(trampoline_mask, long);
+    CARVE(active_group, long);
+    CARVE(active, char);
+    CARVE(grow, char);
+    CARVE(open, char);
+    CARVE(lost, char);
+    CARVE(condition, char);
+    CARVE(disturbed, char);
+#undef CARVE
+    b->world = data;
+    b->old_world = data + cell_count * lane_count;
+    memset(b->world, O_WALL, cell_count * lane_count);
+    for (k = 0; k < lane_count; k++) {
+        const struct state *sk = s[k < state_count ? k : 0];
+        DEBUG_ASSERT(sk->analysis == s[0]->analysis);
+        b->robot_p[k] = point_to_padded(b, sk->robot_x, sk->robot_y);
+        b->water_level[k] = sk->water_level;
+        b->used_robot_waterproofing[k] = sk->used_robot_waterproofing;
+        b->razor_count[k] = sk->razor_count;
+        b->collected_lambda_count[k] = sk->collected_lambda_count;
+        b->move_count[k] = sk->move_count;
+        b->score[k] = sk->score;
+        b->condition[k] = k < state_count ? sk->condition : C_ABORT;
+        b->disturbed[k] = sk->disturbed;
+        b->trampoline_mask[k] = 0;
+        for (t = 1; t <= MAX_TRAMPOLINE_COUNT; t++) {
+            if (!sk->trampoline_x[t])
+                continue;
+            b->trampoline_mask[k] |= 1L << t;
+            b->trampoline_x[t] = sk->trampoline_x[t];
+            b->trampoline_y[t] = sk->trampoline_y[t];
+            b->trampoline_index_to_target_index[t] = sk->trampoline_index_to_target_index[t];
+        }
+        for (y = 1; y <= b->world_h; y++)
+            for (x = 1; x <= b->world_w; x++)
+                put_lane(b, k, point_to_padded(b, x, y), get(sk, x, y));
+    }
+    return b;
+}
+
+
+// Makes moves[k] in state k, exactly as make_one_move would.
+void step_batch(struct batch *b, const char *moves) {
+    DEBUG_ASSERT(b && moves);
+    bool any_active = false;
+    long p, i, k;
+    for (k = 0; k < b->lane_count; k++) {
+        b->active[k] = b->grow[k] = b->open[k] = b->lost[k] = 0;
+        if (k >= b->state_count || b->condition[k] != C_NONE || !is_valid_move(moves[k]))
+            continue;
+        execute_lane_move(b, k, moves[k]);
+        if (b->condition[k] != C_NONE)
+            continue;
+        b->active[k] = -1;
+        b->grow[k] = b->template->beard_growth_rate && !(b->move_count[k] % b->template->beard_growth_rate) ? -1 : 0;
+        b->open[k] = b->collected_lambda_count[k] == b->template->lambda_count ? -1 : 0;
+        any_active = true;
+    }
+    if (!any_active)
+        return;
+    b->active_group_count = 0;
+    for (k = 0; k < b->lane_count; k += BATCH_VECTOR_SIZE) {
+        batch_vector active = LOAD(b->active + k);
+        if (((const unsigned long *)&active)[0] | ((const unsigned long *)&active)[1])
+            b->active_group[b->active_group_count++] = k;
+    }
+    if (b->active_group_count * BATCH_VECTOR_SIZE == b->lane_count)
+        memcpy(b->old_world, b->world, b->padded_w * b->padded_h * b->lane_count);
+    else {
+        for (p = 0; p < b->padded_w * b->padded_h; p++)
+            for (i = 0; i < b->active_group_count; i++)
+                STORE(b->old_world + p * b->lane_count + b->active_group[i]) = LOAD(b->world + p * b->lane_count + b->active_group[i]);
+    }
+    update_batch(b);
+    for (k = 0; k < b->state_count; k++)
+        if (b->active[k])
+            finish_lane_update(b, k);
+}
+
+
+struct state *get_batch_state(const struct batch *b, long k) {
+    DEBUG_ASSERT(b && k >= 0 && k < b->state_count);
+    struct state *s;
+    long t, x, y;
+    s = copy(b->template);
+    padded_to_point(b, b->robot_p[k], &s->robot_x, &s->robot_y);
+    s->water_level = b->water_level[k];
+    s->used_robot_waterproofing = b->used_robot_waterproofing[k];
+    s->razor_count = b->razor_count[k];
+    s->collected_lambda_count = b->collected_lambda_count[k];
+    s->move_count = b->move_count[k];
+    s->score = b->score[k];
+    s->condition = b->condition[k];
+    s->disturbed = b->disturbed[k];
+    s->trampoline_count = 0;
+    for (t = 1; t <= MAX_TRAMPOLINE_COUNT; t++) {
+        if (b->trampoline_mask[k] & (1L << t)) {
+            s->trampoline_x[t] = b->trampoline_x[t];
+            s->trampoline_y[t] = b->trampoline_y[t];
+            s->trampoline_index_to_target_index[t] = b->trampoline_index_to_target_index[t];
+            s->trampoline_count++;
+        } else {
+            s->trampoline_x[t] = 0;
+            s->trampoline_y[t] = 0;
+            s->trampoline_index_to_target_index[t] = 0;
+        }
+    }
+    for (y = 1; y <= b->world_h; y++)
+        for (x = 1; x <= b->world_w; x++)
+            put(s, x, y, get_lane(b, k, point_to_padded(b, x, y)));
+    return s;
+}
+
+long get_batch_score(const struct batch *b, long k) {
+    DEBUG_ASSERT(b && k >= 0 && k < b->state_count);
+    return b->score[k];
+}
+
+char get_batch_condition(const struct batch *b, long k) {
+    DEBUG_ASSERT(b && k >= 0 && k < b->state_count);
+    return b->condition[k];
+}
+
+// The same as hash(get_batch_state(b, k)), without building the state.
+unsigned long get_batch_hash(const struct batch *b, long k) {
+    DEBUG_ASSERT(b && k >= 0 && k < b->state_count);
+    const struct state *template = b->template;
+    unsigned long h = 14695981039346656037UL;
+    long field[7], i;
+    field[0] = b->water_level[k];
+    field[1] = b->used_robot_waterproofing[k];
+    field[2] = b->razor_count[k];
+    field[3] = b->collected_lambda_count[k];
+    field[4] = b->condition[k];
+    field[5] = template->flooding_rate ? b->move_count[k] % template->flooding_rate : 0;
+    field[6] = template->beard_growth_rate ? b->move_count[k] % template->beard_growth_rate : 0;
+    for (i = 0; i < (long)sizeof(field); i++)
+        h = (h ^ ((const unsigned char *)field)[i]) * 1099511628211UL;
+    for (i = 0; i < template->world_length; i++) {
+        if (is_world_index(template, i))
+            h = (h ^ (unsigned char)get_lane(b, k, (i / (b->world_w + 1) + 1) * b->padded_w + i % (b->world_w + 1) + 1)) * 1099511628211UL;
+        else
+            h = (h ^ (unsigned char)template->world[i]) * 1099511628211UL;
+    }
+    return h;
+}
+
+
+// Plays each of the candidate move strings from s0, side by side in one
+// batch, stopping each at its first invalid move as make_moves does.  The
+// caller reads the outcomes from the batch, builds states only for the
+// candidates it keeps, and frees the batch with free().
+struct batch *evaluate_candidates(const struct state *s0, const char *const *moves, long candidate_count) {
+    DEBUG_ASSERT(s0 && moves && candidate_count > 0);
+    const struct state **s;
+    struct batch *b;
+    long *length, max_length = 0, i, k;
+    char *step;
+    if (!(s = calloc(candidate_count, sizeof(const struct state *))) ||
+        !(length = malloc(candidate_count * sizeof(long))) ||
+        !(step = malloc(candidate_count)))
+        PERROR_EXIT("malloc");
+    for (k = 0; k < candidate_count; k++) {
+        s[k] = s0;
+        for (length[k] = 0; is_valid_move(moves[k][length[k]]); length[k]++)
+            ;
+        if (length[k] > max_length)
+            max_length = length[k];
+    }
+    b = new_batch(s, candidate_count);
+    for (i = 0; i < max_length; i++) {
+        for (k = 0; k < candidate_count; k++)
+            step[k] = i < length[k] ? moves[k][i] : 0;
+        step_batch(b, step);
+    }
+    free(s);
+    free(length);
+    free(step);
+    return b;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// The lane versions of move_robot, clear_similar_trampolines, shave_beard and
+// execute_move.  The robot only touches a few cells, so each lane is handled
+// on its own.
+void move_lane_robot(struct batch *b, long k, long p) {
+    DEBUG_ASSERT(b);
+    const struct state *template = b->template;
+    char object;
+    long target_i, x, y;
+    object = get_lane(b, k, p);
+    if (is_valid_trampoline(object)) {
+        target_i = b->trampoline_index_to_target_index[trampoline_to_index(object)];
+        p = point_to_padded(b, template->target_x[target_i], template->target_y[target_i]);
+    }
+    padded_to_point(b, p, &x, &y);
+    if (template->analysis->flags[point_to_index(template, x, y)] & A_FROZEN)
+        b->disturbed[k] = true;
+    put_lane(b, k, b->robot_p[k], O_EMPTY);
+    b->robot_p[k] = p;
+    put_lane(b, k, p, O_ROBOT);
+    if (b->used_robot_waterproofing[k] && y > b->water_level[k])
+        b->used_robot_waterproofing[k] = 0;
+}
+
+void clear_lane_trampolines(struct batch *b, long k, char trampoline) {
+    DEBUG_ASSERT(b && is_valid_trampoline(trampoline));
+    long target_i, i;
+    target_i = b->trampoline_index_to_target_index[trampoline_to_index(trampoline)];
+    for (i = 1; i <= MAX_TRAMPOLINE_COUNT; i++) {
+        if ((b->trampoline_mask[k] & (1L << i)) && b->trampoline_index_to_target_index[i] == target_i) {
+            put_lane(b, k, point_to_padded(b, b->trampoline_x[i], b->trampoline_y[i]), O_EMPTY);
+            b->trampoline_mask[k] &= ~(1L << i);
+        }
+    }
+}
+
+void shave_lane_beard(struct batch *b, long k) {
+    DEBUG_ASSERT(b);
+    long i, j, p;
+    if (!b->razor_count[k])
+        return;
+    for (i = -1; i <= 1; i++) {
+        for (j = -1; j <= 1; j++) {
+            p = b->robot_p[k] + j * b->padded_w + i;
+            if (get_lane(b, k, p) == O_BEARD)
+                put_lane(b, k, p, O_EMPTY);
+        }
+    }
+    b->razor_count[k]--;
+}
+
+void execute_lane_move(struct batch *b, long k, char move) {
+    DEBUG_ASSERT(b && is_valid_move(move));
+    long p, dp;
+    char object;
+    if (move == M_ABORT) {
+        b->condition[k] = C_ABORT;
+        return;
+    }
+    b->move_count[k]++;
+    b->score[k]--;
+    if (move == M_SHAVE) {
+        shave_lane_beard(b, k);
+        return;
+    }
+    if (move == M_WAIT)
+        return;
+    dp = move == M_LEFT ? -1 : move == M_RIGHT ? 1 : move == M_UP ? -b->padded_w : b->padded_w;
+    p = b->robot_p[k] + dp;
+    object = get_lane(b, k, p);
+    if (object == O_EMPTY || object == O_EARTH)
+        move_lane_robot(b, k, p);
+    else if (object == O_LAMBDA) {
+        move_lane_robot(b, k, p);
+        b->collected_lambda_count[k]++;
+        b->score[k] += 50;
+    } else if (object == O_RAZOR) {
+        move_lane_robot(b, k, p);
+        b->razor_count[k]++;
+    } else if (object == O_LIFT_OPEN) {
+        put_lane(b, k, b->robot_p[k], O_EMPTY);
+        b->robot_p[k] = p;
+        b->score[k] += b->collected_lambda_count[k] * 25;
+        b->condition[k] = C_WIN;
+    } else if (is_rock_object(object) && (move == M_LEFT || move == M_RIGHT) && get_lane(b, k, p + dp) == O_EMPTY) {
+        move_lane_robot(b, k, p);
+        put_lane(b, k, p + dp, object);
+    } else if (is_valid_trampoline(object)) {
+        move_lane_robot(b, k, p);
+        clear_lane_trampolines(b, k, object);
+    }
+}
+
+
+// The rules of update_world for one cell, across every lane at once.  Lanes
+// are masked out by active, grow and open; lost records a crushed robot, after
+// which drop_rock stops turning higher order rocks into lambdas.
+void update_batch_cell(struct batch *b, long p) {
+    DEBUG_ASSERT(b);
+    const long lane_count = b->lane_count, row = b->padded_w * lane_count;
+    const long around[8] = {-row - lane_count, -row, -row + lane_count, -lane_count, lane_count, row - lane_count, row, row + lane_count};
+    const signed char *o;
+    signed char *n;
+    batch_vector object, rock, beard, lift, below, below_rock, right_free, left_free, fall, right, left, moved, below_dest, lambda, value;
+    long j, g, i;
+    for (j = 0; j < b->active_group_count; j++) {
+        g = b->active_group[j];
+        o = (const signed char *)b->old_world + p * lane_count + g;
+        n = (signed char *)b->world + p * lane_count + g;
+        object = LOAD(o);
+        rock = ((object == SPLAT(O_ROCK)) | (object == SPLAT(O_HO_ROCK))) & LOAD(b->active + g);
+        beard = (object == SPLAT(O_BEARD)) & LOAD(b->grow + g);
+        lift = (object == SPLAT(O_LIFT_CLOSED)) & LOAD(b->open + g);
+        if (((const unsigned long *)&rock)[0] | ((const unsigned long *)&rock)[1]) {
+            below = LOAD(o + row);
+            below_rock = (below == SPLAT(O_ROCK)) | (below == SPLAT(O_HO_ROCK));
+            right_free = (LOAD(o + lane_count) == SPLAT(O_EMPTY)) & (LOAD(o + row + lane_count) == SPLAT(O_EMPTY));
+            left_free = (LOAD(o - lane_count) == SPLAT(O_EMPTY)) & (LOAD(o + row - lane_count) == SPLAT(O_EMPTY));
+            fall = rock & (below == SPLAT(O_EMPTY));
+            right = rock & right_free & (below_rock | (below == SPLAT(O_LAMBDA)));
+            left = rock & below_rock & ~right_free & left_free;
+            moved = fall | right | left;
+            below_dest = (fall & LOAD(o + 2 * row)) | (right & LOAD(o + 2 * row + lane_count)) | (left & LOAD(o + 2 * row - lane_count));
+            lambda = moved & (object == SPLAT(O_HO_ROCK)) & (below_dest != SPLAT(O_EMPTY)) & ~LOAD(b->lost + g);
+            value = SELECT(lambda, SPLAT(O_LAMBDA), object);
+            STORE(n) = SELECT(moved, SPLAT(O_EMPTY), LOAD(n));
+            STORE(n + row) = SELECT(fall, value, LOAD(n + row));
+            STORE(n + row + lane_count) = SELECT(right, value, LOAD(n + row + lane_count));
+            STORE(n + row - lane_count) = SELECT(left, value, LOAD(n + row - lane_count));
+            STORE(b->lost + g) = LOAD(b->lost + g) | (moved & (below_dest == SPLAT(O_ROBOT)));
+        }
+        if (((const unsigned long *)&beard)[0] | ((const unsigned long *)&beard)[1]) {
+            for (i = 0; i < 8; i++)
+                STORE(n + around[i]) = SELECT(beard & (LOAD(o + around[i]) == SPLAT(O_EMPTY)), SPLAT(O_BEARD), LOAD(n + around[i]));
+        }
+        if (((const unsigned long *)&lift)[0] | ((const unsigned long *)&lift)[1])
+            STORE(n) = SELECT(lift, SPLAT(O_LIFT_OPEN), LOAD(n));
+    }
+}
+
+// Cells are visited in update_world's order.  Frozen cells are skipped unless
+// some lane has disturbed them.
+void update_batch(struct batch *b) {
+    DEBUG_ASSERT(b);
+    const struct analysis *a = b->template->analysis;
+    const long full_span[2] = {1, b->world_w};
+    const long *span;
+    bool disturbed = false;
+    long span_count, x, y, i, k;
+    for (k = 0; k < b->state_count; k++)
+        disturbed = disturbed || (b->active[k] && b->disturbed[k]);
+    for (y = 1; y <= b->world_h; y++) {
+        if (disturbed) {
+            span = full_span;
+            span_count = 1;
+        } else {
+            span = a->span + 2 * a->span_offset[y - 1];
+            span_count = a->span_offset[y] - a->span_offset[y - 1];
+        }
+        for (i = 0; i < 2 * span_count; i += 2)
+            for (x = span[i]; x <= span[i + 1]; x++)
+                update_batch_cell(b, point_to_padded(b, x, y));
+    }
+}
+
+// The end of update_world, for one lane.
+void finish_lane_update(struct batch *b, long k) {
+    DEBUG_ASSERT(b);
+    const struct state *template = b->template;
+    long x, y;
+    if (b->lost[k]) {
+        b->score[k] -= b->collected_lambda_count[k] * 25;
+        b->condition[k] = C_LOSE;
+        return;
+    }
+    padded_to_point(b, b->robot_p[k], &x, &y);
+    if (y <= b->water_level[k]) {
+        b->used_robot_waterproofing[k]++;
+        if (b->used_robot_waterproofing[k] > template->robot_waterproofing) {
+            b->score[k] -= b->collected_lambda_count[k] * 25;
+            b->condition[k] = C_LOSE;
+        }
+    }
+    if (template->flooding_rate && !(b->move_count[k] % template->flooding_rate))
+        b->water_level[k]++;
+    if (b->move_count[k] == b->world_w * b->world_h)
+        b->condition[k] = C_ABORT;
+}
@@ -0,0 +1,91 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+struct batch *new_batch(const struct state *const *s, long state_count);
+
+void step_batch(struct batch *b, const char *moves);
+
+struct state *get_batch_state(const struct batch *b, long k);
+long get_batch_score(const struct batch *b, long k);
+char get_batch_condition(const struct batch *b, long k);
+unsigned long get_batch_hash(const struct batch *b, long k);
+
+struct batch *evaluate_candidates(const struct state *s0, const char *const *moves, long candidate_count);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// States are simulated in groups of BATCH_VECTOR_SIZE lanes, one per byte of
+// a vector register.
+#define BATCH_VECTOR_SIZE 16
+
+typedef signed char batch_vector __attribute__((vector_size(BATCH_VECTOR_SIZE), may_alias));
+
+
+// The worlds of all states are stored cell by cell, with the lanes of each
+// cell next to each other, and surrounded by walls: one column on each side,
+// one row above and two below, so that no rule needs a bounds check.  Per
+// state fields are kept in arrays indexed by lane.  Each update reads the
+// lanes being moved from a snapshot in old_world.
+struct batch {
+    long state_count;
+    long lane_count;
+    long world_w, world_h;
+    long padded_w, padded_h;
+    const struct state *template;
+    long trampoline_x[MAX_TRAMPOLINE_COUNT + 1], trampoline_y[MAX_TRAMPOLINE_COUNT + 1];
+    long trampoline_index_to_target_index[MAX_TRAMPOLINE_COUNT + 1];
+    long *robot_p;
+    long *water_level;
+    long *used_robot_waterproofing;
+    long *razor_count;
+    long *collected_lambda_count;
+    long *move_count;
+    long *score;
+    long *trampoline_mask;
+    long *active_group;
+    long active_group_count;
+    char *condition;
+    char *disturbed;
+    char *active;
+    char *grow;
+    char *open;
+    char *lost;
+    char *world;
+    char *old_world;
+};
+
+
+inline long point_to_padded(const struct batch *b, long x, long y) {
+    DEBUG_ASSERT(b);
+    return (b->world_h - y + 1) * b->padded_w + x;
+}
+
+inline void padded_to_point(const struct batch *b, long p, long *out_x, long *out_y) {
+    DEBUG_ASSERT(b && out_x && out_y);
+    *out_x = p % b->padded_w;
+    *out_y = b->world_h + 1 - p / b->padded_w;
+}
+
+inline char get_lane(const struct batch *b, long k, long p) {
+    DEBUG_ASSERT(b && k >= 0 && k < b->lane_count);
+    return b->world[p * b->lane_count + k];
+}
+
+inline void put_lane(struct batch *b, long k, long p, char object) {
+    DEBUG_ASSERT(b && k >= 0 && k < b->lane_count);
+    b->world[p * b->lane_count + k] = object;
+}
+
+
+void move_lane_robot(struct batch *b, long k, long p);
+void clear_lane_trampolines(struct batch *b, long k, char trampoline);
+void shave_lane_beard(struct batch *b, long k);
+void execute_lane_move(struct batch *b, long k, char move);
+
+void update_batch_cell(struct batch *b, long p);
+void update_batch(struct batch *b);
+void finish_lane_update(struct batch *b, long k);
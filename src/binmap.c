@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "binmap.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+void save_binary_map(const struct state *s, const char *path) {
+    DEBUG_ASSERT(s && path);
+    const struct analysis *a = s->analysis;
+    struct binary_map_header h;
+    struct state *image_s;
+    struct analysis *image_a;
+    char *image;
+    FILE *f;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BINARY_MAP_MAGIC, sizeof(h.magic));
+    h.version = BINARY_MAP_VERSION;
+    h.state_size = sizeof(struct state);
+    h.analysis_size = sizeof(struct analysis) + a->world_length;
+    h.world_w = s->world_w;
+    h.world_h = s->world_h;
+    h.world_length = s->world_length;
+    h.span_count = a->span_offset[s->world_h];
+    h.state_offset = align_binary_map_offset(sizeof(h));
+    h.analysis_offset = align_binary_map_offset(h.state_offset + sizeof(struct state) + s->world_length);
+    h.component_offset = align_binary_map_offset(h.analysis_offset + h.analysis_size);
+    h.lift_dist_offset = h.component_offset + sizeof(long) * s->world_length;
+    h.span_offset_offset = h.lift_dist_offset + sizeof(long) * s->world_length;
+    h.span_offset = h.span_offset_offset + sizeof(long) * (s->world_h + 1);
+    h.length = h.span_offset + sizeof(long) * 2 * h.span_count;
+    if (!(image = calloc(h.length, 1)))
+        PERROR_EXIT("calloc");
+    memcpy(image, &h, sizeof(h));
+    image_s = (struct state *)(image + h.state_offset);
+    memcpy(image_s, s, sizeof(struct state) + s->world_length);
+    image_s->analysis = NULL;
+    image_a = (struct analysis *)(image + h.analysis_offset);
+    memcpy(image_a, a, h.analysis_size);
+    image_a->component = image_a->lift_dist = image_a->span_offset = image_a->span = NULL;
+    memcpy(image + h.component_offset, a->component, sizeof(long) * s->world_length);
+    memcpy(image + h.lift_dist_offset, a->lift_dist, sizeof(long) * s->world_length);
+    memcpy(image + h.span_offset_offset, a->span_offset, sizeof(long) * (s->world_h + 1));
+    memcpy(image + h.span_offset, a->span, sizeof(long) * 2 * h.span_count);
+    if (!(f = fopen(path, "wb")))
+        PERROR_EXIT(path);
+    if (fwrite(image, 1, h.length, f) != (size_t)h.length)
+        PERROR_EXIT("fwrite");
+    if (fclose(f))
+        PERROR_EXIT("fclose");
+    free(image);
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+bool is_binary_map(long input_length, const char *input) {
+    DEBUG_ASSERT(input);
+    return input_length >= (long)sizeof(struct binary_map_header) && !memcmp(input, BINARY_MAP_MAGIC, sizeof(BINARY_MAP_MAGIC));
+}
+
+// Points the state and the analysis in a writable image at the arrays after
+// them, and returns the state.  The image must outlive every state copied
+// from it, as they share its analysis.
+struct state *load_binary_map(long image_length, char *image) {
+    DEBUG_ASSERT(image && is_binary_map(image_length, image));
+    struct binary_map_header h;
+    struct state *s;
+    struct analysis *a;
+    memcpy(&h, image, sizeof(h));
+    if (h.version != BINARY_MAP_VERSION || h.state_size != sizeof(struct state) ||
+        h.analysis_size != (long)sizeof(struct analysis) + h.world_length || h.length > image_length)
+        LOG_EXIT("compiled map is from another version of libvm\n");
+    s = (struct state *)(image + h.state_offset);
+    a = (struct analysis *)(image + h.analysis_offset);
+    a->component = (long *)(image + h.component_offset);
+    a->lift_dist = (long *)(image + h.lift_dist_offset);
+    a->span_offset = (long *)(image + h.span_offset_offset);
+    a->span = (long *)(image + h.span_offset);
+    s->analysis = a;
+    return s;
+}
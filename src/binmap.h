@@ -0,0 +1,45 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+void save_binary_map(const struct state *s, const char *path);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+#define BINARY_MAP_MAGIC "\177LAMBDA"
+#define BINARY_MAP_VERSION 1
+
+
+// A compiled map is the initial state and its analysis as they are laid out
+// in memory, each array starting on a long boundary, after a header giving
+// their offsets from the start of the file.  It is only meant to be read by
+// the build of libvm that wrote it, so the layout of struct state is checked
+// but nothing is converted.
+struct binary_map_header {
+    char magic[8];
+    long version;
+    long state_size;
+    long analysis_size;
+    long world_w, world_h;
+    long world_length;
+    long span_count;
+    long state_offset;
+    long analysis_offset;
+    long component_offset;
+    long lift_dist_offset;
+    long span_offset_offset;
+    long span_offset;
+    long length;
+};
+
+
+inline long align_binary_map_offset(long offset) {
+    return (offset + sizeof(long) - 1) & ~(long)(sizeof(long) - 1);
+}
+
+
+bool is_binary_map(long input_length, const char *input);
+struct state *load_binary_map(long image_length, char *image);
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libvm.h"
+#include "cache.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// Returns the cached moves for the map s0 starts, or NULL, after checking
+// with libvm that they still score what the cache says.
+char *load_solution(const struct state *s0, long *out_score) {
+    DEBUG_ASSERT(s0 && out_score);
+    char *path, *line = NULL, *moves = NULL;
+    size_t line_size = 0;
+    long score = LONG_MIN, length;
+    struct state *s;
+    FILE *f;
+    if (!(path = get_solution_path(s0)))
+        return NULL;
+    f = fopen(path, "r");
+    free(path);
+    if (!f)
+        return NULL;
+    while ((length = getline(&line, &line_size, f)) != -1) {
+        if (length && line[length - 1] == '\n')
+            line[--length] = 0;
+        if (!strncmp(line, "score ", 6))
+            score = atol(line + 6);
+        else if (!strncmp(line, "moves ", 6) && !moves && !(moves = strdup(line + 6)))
+            PERROR_EXIT("strdup");
+    }
+    free(line);
+    fclose(f);
+    if (!moves)
+        return NULL;
+    if (moves[strspn(moves, "LRUDWAS")]) {
+        free(moves);
+        return NULL;
+    }
+    s = make_moves(s0, moves);
+    if (get_score(s) == score)
+        *out_score = score;
+    else {
+        free(moves);
+        moves = NULL;
+    }
+    free(s);
+    return moves;
+}
+
+// Keeps the moves if they beat the cached solution, replacing the file
+// atomically, so that lifters sharing the cache never see half of one.
+void save_solution(const struct state *s0, const char *moves, const char *found_by) {
+    DEBUG_ASSERT(s0 && moves && found_by);
+    char *path, *temp_path, *cached_moves;
+    long score, cached_score;
+    struct state *s;
+    FILE *f;
+    s = make_moves(s0, moves);
+    score = get_score(s);
+    free(s);
+    if ((cached_moves = load_solution(s0, &cached_score))) {
+        free(cached_moves);
+        if (cached_score >= score)
+            return;
+    }
+    if (!(path = get_solution_path(s0)))
+        return;
+    if (!(temp_path = malloc(strlen(path) + 32)))
+        PERROR_EXIT("malloc");
+    sprintf(temp_path, "%s.%ld", path, (long)getpid());
+    if ((f = fopen(temp_path, "w"))) {
+        fprintf(f, "score %ld\nmoves %s\nfound_by %s\ntime %ld\n", score, moves, found_by, (long)time(NULL));
+        if (fclose(f) || rename(temp_path, path))
+            unlink(temp_path);
+    }
+    free(temp_path);
+    free(path);
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// FNV-1a over the fields and world of an initial state, which the loader has
+// already normalised: rows padded, metadata parsed and put in order.
+unsigned long hash_map(const struct state *s0) {
+    DEBUG_ASSERT(s0);
+    const unsigned char *p = (const unsigned char *)s0 + offsetof(struct state, world_w);
+    unsigned long h = 14695981039346656037UL;
+    long length = sizeof(struct state) - offsetof(struct state, world_w) + s0->world_length, i;
+    for (i = 0; i < length; i++)
+        h = (h ^ p[i]) * 1099511628211UL;
+    return h;
+}
+
+// Returns NULL if the cache is turned off or its directory cannot be made.
+char *get_solution_path(const struct state *s0) {
+    DEBUG_ASSERT(s0);
+    const char *dir = getenv(CACHE_ENV), *home;
+    char *path;
+    if (dir && !*dir)
+        return NULL;
+    if (!dir && !(home = getenv("HOME")))
+        return NULL;
+    if (!(path = malloc((dir ? strlen(dir) : strlen(home) + strlen(DEFAULT_CACHE_DIR) + 1) + 32)))
+        PERROR_EXIT("malloc");
+    if (dir)
+        strcpy(path, dir);
+    else
+        sprintf(path, "%s/%s", home, DEFAULT_CACHE_DIR);
+    if (!make_cache_dir(path)) {
+        free(path);
+        return NULL;
+    }
+    sprintf(path + strlen(path), "/%016lx", hash_map(s0));
+    return path;
+}
+
+// Makes the directory and any missing parents.
+bool make_cache_dir(const char *path) {
+    DEBUG_ASSERT(path);
+    char *parent, *slash;
+    bool made;
+    if (!mkdir(path, 0777) || errno == EEXIST)
+        return true;
+    if (errno != ENOENT)
+        return false;
+    if (!(parent = strdup(path)))
+        PERROR_EXIT("strdup");
+    made = (slash = strrchr(parent, '/')) && slash != parent && (*slash = 0, make_cache_dir(parent)) && (!mkdir(path, 0777) || errno == EEXIST);
+    free(parent);
+    return made;
+}
@@ -0,0 +1,21 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+char *load_solution(const struct state *s0, long *out_score);
+void save_solution(const struct state *s0, const char *moves, const char *found_by);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// Solutions are kept one file per map in $LIFTER_CACHE, or in
+// ~/.cache/lifter if it is unset.  Setting it to nothing turns the cache off.
+#define CACHE_ENV "LIFTER_CACHE"
+#define DEFAULT_CACHE_DIR ".cache/lifter"
+
+
+unsigned long hash_map(const struct state *s0);
+char *get_solution_path(const struct state *s0);
+bool make_cache_dir(const char *path);
@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "history.h"
+#include "frontier.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// A frontier holds at most max_entry_count states like s0, and no more than
+// fit in memory_limit bytes, or FRONTIER_MEMORY_LIMIT if it is 0.
+struct frontier *new_frontier(const struct state *s0, long max_entry_count, long memory_limit) {
+    DEBUG_ASSERT(s0 && max_entry_count > 0 && memory_limit >= 0);
+    struct frontier *f;
+    long slot_count, i;
+    if (!(f = malloc(sizeof(struct frontier))))
+        PERROR_EXIT("malloc");
+    f->state_size = (sizeof(struct state) + s0->world_length + 15) & ~15L;
+    if (!memory_limit)
+        memory_limit = FRONTIER_MEMORY_LIMIT;
+    if (max_entry_count > memory_limit / f->state_size)
+        max_entry_count = memory_limit / f->state_size > 1 ? memory_limit / f->state_size : 1;
+    f->max_entry_count = max_entry_count;
+    f->entry_count = 0;
+    for (slot_count = 16; slot_count < 2 * max_entry_count; slot_count *= 2)
+        ;
+    f->slot_mask = slot_count - 1;
+    if (!(f->states = malloc(max_entry_count * f->state_size)) || !(f->entry = malloc(max_entry_count * sizeof(struct frontier_entry))))
+        PERROR_EXIT("malloc");
+    if (!(f->free_entry = malloc(max_entry_count * sizeof(long))) || !(f->heap[H_BEST] = malloc(max_entry_count * sizeof(long))) || !(f->heap[H_WORST] = malloc(max_entry_count * sizeof(long))))
+        PERROR_EXIT("malloc");
+    if (!(f->slot = malloc(slot_count * sizeof(long))))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < max_entry_count; i++) {
+        f->entry[i].state = (struct state *)(f->states + i * f->state_size);
+        f->free_entry[i] = i;
+    }
+    for (i = 0; i < slot_count; i++)
+        f->slot[i] = -1;
+    return f;
+}
+
+void free_frontier(struct frontier *f) {
+    DEBUG_ASSERT(f);
+    long i;
+    for (i = 0; i < f->entry_count; i++)
+        release_history(f->entry[f->heap[H_BEST][i]].history);
+    free(f->states);
+    free(f->entry);
+    free(f->free_entry);
+    free(f->heap[H_BEST]);
+    free(f->heap[H_WORST]);
+    free(f->slot);
+    free(f);
+}
+
+// Copies s in, with a reference to h, unless a state that hashes the same is
+// there already with a key no lower, or the frontier is full of states with
+// keys no lower.  A full frontier evicts its lowest key to make room.
+// Returns whether s went in.
+bool push_frontier(struct frontier *f, const struct state *s, long key, long steps, struct history *h) {
+    DEBUG_ASSERT(f && s);
+    struct frontier_entry *e;
+    unsigned long state_hash;
+    long entry_i, i;
+    state_hash = hash(s);
+    i = find_slot(f, state_hash);
+    if ((entry_i = f->slot[i]) != -1) {
+        e = &f->entry[entry_i];
+        if (e->key >= key)
+            return false;
+    } else {
+        if (f->entry_count == f->max_entry_count) {
+            entry_i = f->heap[H_WORST][0];
+            if (f->entry[entry_i].key >= key)
+                return false;
+            release_history(f->entry[entry_i].history);
+            remove_entry(f, entry_i);
+            i = find_slot(f, state_hash);
+        }
+        entry_i = f->free_entry[f->max_entry_count - f->entry_count - 1];
+        e = &f->entry[entry_i];
+        e->hash = state_hash;
+        e->history = NULL;
+        f->slot[i] = entry_i;
+        put_in_heap(f, H_BEST, f->entry_count, entry_i);
+        put_in_heap(f, H_WORST, f->entry_count, entry_i);
+        f->entry_count++;
+    }
+    memcpy(e->state, s, sizeof(struct state) + s->world_length);
+    e->key = key;
+    e->steps = steps;
+    release_history(e->history);
+    e->history = retain_history(h);
+    fix_heap(f, H_BEST, e->heap_i[H_BEST]);
+    fix_heap(f, H_WORST, e->heap_i[H_WORST]);
+    return true;
+}
+
+// Takes out the state with the highest key, or returns NULL if there is none.
+// The state is to be freed with free(), and the reference to its history
+// passes to the caller.
+struct state *pop_frontier(struct frontier *f, long *out_key, long *out_steps, struct history **out_h) {
+    DEBUG_ASSERT(f && out_key && out_steps && out_h);
+    struct frontier_entry *e;
+    struct state *s;
+    if (!f->entry_count)
+        return NULL;
+    e = &f->entry[f->heap[H_BEST][0]];
+    if (!(s = malloc(sizeof(struct state) + e->state->world_length)))
+        PERROR_EXIT("malloc");
+    memcpy(s, e->state, sizeof(struct state) + e->state->world_length);
+    *out_key = e->key;
+    *out_steps = e->steps;
+    *out_h = e->history;
+    remove_entry(f, f->heap[H_BEST][0]);
+    return s;
+}
+
+long get_frontier_size(const struct frontier *f) {
+    DEBUG_ASSERT(f);
+    return f->entry_count;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+bool is_above(const struct frontier *f, long heap, long entry_i, long entry_j) {
+    DEBUG_ASSERT(f);
+    if (heap == H_BEST)
+        return f->entry[entry_i].key > f->entry[entry_j].key;
+    return f->entry[entry_i].key < f->entry[entry_j].key;
+}
+
+void put_in_heap(struct frontier *f, long heap, long i, long entry_i) {
+    DEBUG_ASSERT(f);
+    f->heap[heap][i] = entry_i;
+    f->entry[entry_i].heap_i[heap] = i;
+}
+
+void sift_up(struct frontier *f, long heap, long i) {
+    DEBUG_ASSERT(f && i < f->entry_count);
+    long entry_i = f->heap[heap][i], parent;
+    for (; i && is_above(f, heap, entry_i, f->heap[heap][parent = (i - 1) / 2]); i = parent)
+        put_in_heap(f, heap, i, f->heap[heap][parent]);
+    put_in_heap(f, heap, i, entry_i);
+}
+
+void sift_down(struct frontier *f, long heap, long i) {
+    DEBUG_ASSERT(f && i < f->entry_count);
+    long entry_i = f->heap[heap][i], child;
+    while ((child = 2 * i + 1) < f->entry_count) {
+        if (child + 1 < f->entry_count && is_above(f, heap, f->heap[heap][child + 1], f->heap[heap][child]))
+            child++;
+        if (!is_above(f, heap, f->heap[heap][child], entry_i))
+            break;
+        put_in_heap(f, heap, i, f->heap[heap][child]);
+        i = child;
+    }
+    put_in_heap(f, heap, i, entry_i);
+}
+
+// Restores the order around i after the key of the entry there changed.
+void fix_heap(struct frontier *f, long heap, long i) {
+    DEBUG_ASSERT(f);
+    long entry_i = f->heap[heap][i];
+    sift_up(f, heap, i);
+    if (f->entry[entry_i].heap_i[heap] == i)
+        sift_down(f, heap, i);
+}
+
+
+// Linear probing from the hash: returns the slot holding the entry with the
+// hash, or the empty slot where it would go.
+long find_slot(const struct frontier *f, unsigned long hash) {
+    DEBUG_ASSERT(f);
+    long i;
+    for (i = hash & f->slot_mask; f->slot[i] != -1 && f->entry[f->slot[i]].hash != hash; i = (i + 1) & f->slot_mask)
+        ;
+    return i;
+}
+
+// Empties slot i, moving back any entry after it that could no longer be
+// found past the gap.
+void remove_slot(struct frontier *f, long i) {
+    DEBUG_ASSERT(f && f->slot[i] != -1);
+    long j = i, k;
+    while (true) {
+        f->slot[i] = -1;
+        while (true) {
+            j = (j + 1) & f->slot_mask;
+            if (f->slot[j] == -1)
+                return;
+            k = f->entry[f->slot[j]].hash & f->slot_mask;
+            if (i <= j ? i < k && k <= j : i < k || k <= j)
+                continue;
+            break;
+        }
+        f->slot[i] = f->slot[j];
+        i = j;
+    }
+}
+
+// Takes the entry out of both heaps and the slots, leaving its history alone.
+void remove_entry(struct frontier *f, long entry_i) {
+    DEBUG_ASSERT(f && f->entry_count);
+    long heap, i, last_i;
+    remove_slot(f, find_slot(f, f->entry[entry_i].hash));
+    f->entry_count--;
+    for (heap = H_BEST; heap <= H_WORST; heap++) {
+        i = f->entry[entry_i].heap_i[heap];
+        if (i == f->entry_count)
+            continue;
+        last_i = f->heap[heap][f->entry_count];
+        put_in_heap(f, heap, i, last_i);
+        fix_heap(f, heap, i);
+    }
+    f->free_entry[f->max_entry_count - f->entry_count - 1] = entry_i;
+}
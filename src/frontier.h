@@ -0,0 +1,57 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+struct frontier *new_frontier(const struct state *s0, long max_entry_count, long memory_limit);
+void free_frontier(struct frontier *f);
+
+bool push_frontier(struct frontier *f, const struct state *s, long key, long steps, struct history *h);
+struct state *pop_frontier(struct frontier *f, long *out_key, long *out_steps, struct history **out_h);
+long get_frontier_size(const struct frontier *f);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+#define FRONTIER_MEMORY_LIMIT (256L << 20)
+
+#define H_BEST  0
+#define H_WORST 1
+
+
+// Each entry owns a copy of its state and a reference to its history, and is
+// kept in two heaps at once: one with the highest key on top, to pop from,
+// and one with the lowest, to evict from when the frontier is full.  Entries
+// whose states hash the same are the same entry, with the highest key pushed.
+struct frontier_entry {
+    struct state *state;
+    unsigned long hash;
+    long key;
+    long steps;
+    struct history *history;
+    long heap_i[2];
+};
+
+struct frontier {
+    long state_size;
+    long max_entry_count;
+    long entry_count;
+    char *states;
+    struct frontier_entry *entry;
+    long *free_entry;
+    long *heap[2];
+    long *slot;
+    long slot_mask;
+};
+
+
+bool is_above(const struct frontier *f, long heap, long entry_i, long entry_j);
+void put_in_heap(struct frontier *f, long heap, long i, long entry_i);
+void sift_up(struct frontier *f, long heap, long i);
+void sift_down(struct frontier *f, long heap, long i);
+void fix_heap(struct frontier *f, long heap, long i);
+
+long find_slot(const struct frontier *f, unsigned long hash);
+void remove_slot(struct frontier *f, long i);
+void remove_entry(struct frontier *f, long entry_i);
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "history.h"
+
+
+static struct history_arena arena = { PTHREAD_MUTEX_INITIALIZER, NULL };
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// Returns the history h followed by the moves, to be released with
+// release_history.  Takes time in proportion to the number of moves, whatever
+// the length of h, and leaves h as it was.
+struct history *extend_history(struct history *h, const char *moves) {
+    DEBUG_ASSERT(moves);
+    struct history *h1;
+    long length;
+    if (h)
+        __sync_fetch_and_add(&h->reference_count, 1);
+    length = strlen(moves);
+    do {
+        h1 = new_history_node();
+        h1->parent = h;
+        h1->chunk_length = length < HISTORY_CHUNK_SIZE ? length : HISTORY_CHUNK_SIZE;
+        h1->length = (h ? h->length : 0) + h1->chunk_length;
+        memcpy(h1->chunk, moves, h1->chunk_length);
+        moves += h1->chunk_length;
+        length -= h1->chunk_length;
+        h = h1;
+    } while (length);
+    return h;
+}
+
+// Returns h, holding one more reference to it.
+struct history *retain_history(struct history *h) {
+    if (h)
+        __sync_fetch_and_add(&h->reference_count, 1);
+    return h;
+}
+
+// Lets go of one reference, and of the histories before it that no one else
+// holds.
+void release_history(struct history *h) {
+    struct history *parent;
+    while (h && !__sync_sub_and_fetch(&h->reference_count, 1)) {
+        parent = h->parent;
+        free_history_node(h);
+        h = parent;
+    }
+}
+
+long get_history_length(const struct history *h) {
+    return h ? h->length : 0;
+}
+
+// Returns the moves, to be freed with free().
+char *get_history_moves(const struct history *h) {
+    char *moves;
+    long length;
+    length = get_history_length(h);
+    if (!(moves = malloc(length + 1)))
+        PERROR_EXIT("malloc");
+    moves[length] = 0;
+    for (; h; h = h->parent) {
+        length -= h->chunk_length;
+        memcpy(moves + length, h->chunk, h->chunk_length);
+    }
+    DEBUG_ASSERT(!length);
+    return moves;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+struct history *new_history_node(void) {
+    struct history *h, *block;
+    long i;
+    pthread_mutex_lock(&arena.mutex);
+    if (!arena.free) {
+        if (!(block = malloc(HISTORY_BLOCK_SIZE * sizeof(struct history))))
+            PERROR_EXIT("malloc");
+        for (i = 0; i < HISTORY_BLOCK_SIZE; i++) {
+            block[i].parent = arena.free;
+            arena.free = &block[i];
+        }
+    }
+    h = arena.free;
+    arena.free = h->parent;
+    pthread_mutex_unlock(&arena.mutex);
+    h->reference_count = 1;
+    return h;
+}
+
+void free_history_node(struct history *h) {
+    DEBUG_ASSERT(h);
+    pthread_mutex_lock(&arena.mutex);
+    h->parent = arena.free;
+    arena.free = h;
+    pthread_mutex_unlock(&arena.mutex);
+}
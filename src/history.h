@@ -0,0 +1,41 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+struct history *extend_history(struct history *h, const char *moves);
+struct history *retain_history(struct history *h);
+void release_history(struct history *h);
+
+long get_history_length(const struct history *h);
+char *get_history_moves(const struct history *h);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+#define HISTORY_CHUNK_SIZE 39
+#define HISTORY_BLOCK_SIZE 4096
+
+
+// The moves to a state, as a chunk of the last few moves and a counted
+// reference to the history before them, which any number of other histories
+// may share.  NULL is the empty history.  Nodes are all the same size, and
+// are carved out of blocks that are never freed, so they can be reused
+// without going through malloc.
+struct history {
+    struct history *parent;
+    long reference_count;
+    long length;
+    unsigned char chunk_length;
+    char chunk[HISTORY_CHUNK_SIZE];
+};
+
+struct history_arena {
+    pthread_mutex_t mutex;
+    struct history *free;
+};
+
+
+struct history *new_history_node(void);
+void free_history_node(struct history *h);
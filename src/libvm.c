@@ -1,7 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +14,7 @@
 #include <unistd.h>
 
 #include "libvm.h"
+#include "binmap.h"
 
 
 // ---------------------------------------------------------------------------
@@ -18,41 +23,70 @@
 
 struct state *new(long input_length, const char *input) {
     DEBUG_ASSERT(input);
-    long world_w, world_h, world_length;
-    struct state *s;
-    scan_input(input_length, input, &world_w, &world_h);
-    world_length = (world_w + 1) * world_h + 1;
-    if (!(s = malloc(sizeof(struct state) + world_length)))
-        PERROR_EXIT("malloc");
-    memset(s, 0, sizeof(struct state));
-    s->world_w = world_w;
-    s->world_h = world_h;
-    s->robot_waterproofing = DEFAULT_ROBOT_WATERPROOFING;
-    s->beard_growth_rate = DEFAULT_BEARD_GROWTH_RATE;
-    s->condition = C_NONE;
-    s->world_length = world_length;
-    copy_input(s, input_length, input);
-    return s;
+    struct loader l;
+    char *image;
+    if (is_binary_map(input_length, input)) {
+        if (!(image = malloc(input_length)))
+            PERROR_EXIT("malloc");
+        memcpy(image, input, input_length);
+        return copy(load_binary_map(input_length, image));
+    }
+    init_loader(&l);
+    feed_loader(&l, input_length, input);
+    return finish_loader(&l);
 }
 
 struct state *new_from_file(const char *path) {
     DEBUG_ASSERT(path);
     int fd;
     struct stat info;
-    char *input;
+    char magic[sizeof(BINARY_MAP_MAGIC)];
+    char *image;
     struct state *s;
     if ((fd = open(path, O_RDONLY)) == -1)
         PERROR_EXIT("open");
     if (fstat(fd, &info) == -1)
         PERROR_EXIT("fstat");
-    if ((input = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0)) == (char *)-1)
-        PERROR_EXIT("mmap");
-    s = new(info.st_size, input);
-    munmap(input, info.st_size);
+    // A compiled map stays mapped, as its analysis is used in place.
+    if (info.st_size >= (long)sizeof(struct binary_map_header) && pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && !memcmp(magic, BINARY_MAP_MAGIC, sizeof(magic))) {
+        if ((image = mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == (char *)-1)
+            PERROR_EXIT("mmap");
+        s = copy(load_binary_map(info.st_size, image));
+    } else
+        s = new_from_fd(fd);
     close(fd);
     return s;
 }
 
+// Reads a map from a file descriptor, which may be a pipe, in chunks.  A
+// compiled map is read whole and loaded with new.
+struct state *new_from_fd(int fd) {
+    struct loader l;
+    struct state *s;
+    char *chunk;
+    long length = 0, capacity = LOADER_CHUNK_SIZE, n;
+    if (!(chunk = malloc(capacity)))
+        PERROR_EXIT("malloc");
+    while (length < (long)sizeof(struct binary_map_header) && (n = read_chunk(fd, chunk + length, capacity - length)) > 0)
+        length += n;
+    if (is_binary_map(length, chunk)) {
+        do {
+            if (length == capacity && !(chunk = realloc(chunk, capacity *= 2)))
+                PERROR_EXIT("realloc");
+            length += n = read_chunk(fd, chunk + length, capacity - length);
+        } while (n > 0);
+        s = new(length, chunk);
+        free(chunk);
+        return s;
+    }
+    init_loader(&l);
+    do
+        feed_loader(&l, length, chunk);
+    while ((length = read_chunk(fd, chunk, capacity)) > 0);
+    free(chunk);
+    return finish_loader(&l);
+}
+
 struct state *copy(const struct state *s0) {
     DEBUG_ASSERT(s0);
     struct state *s;
@@ -64,9 +98,32 @@ struct state *copy(const struct state *s0) {
 
 bool equal(const struct state *s1, const struct state *s2) {
     DEBUG_ASSERT(s1 && s2);
+    const size_t offset = offsetof(struct state, world_w);
     if (s1->world_length != s2->world_length)
         return false;
-    return !memcmp(s1, s2, sizeof(struct state) + s1->world_length);
+    return !memcmp((const char *)s1 + offset, (const char *)s2 + offset, sizeof(struct state) - offset + s1->world_length);
+}
+
+// FNV-1a over everything that decides what happens next.  The score and the
+// move count are left out, except for where the move count falls in the
+// flooding and beard growth cycles, so that states reached along different
+// paths hash the same.
+unsigned long hash(const struct state *s) {
+    DEBUG_ASSERT(s);
+    unsigned long h = 14695981039346656037UL;
+    long field[7], i;
+    field[0] = s->water_level;
+    field[1] = s->used_robot_waterproofing;
+    field[2] = s->razor_count;
+    field[3] = s->collected_lambda_count;
+    field[4] = s->condition;
+    field[5] = s->flooding_rate ? s->move_count % s->flooding_rate : 0;
+    field[6] = s->beard_growth_rate ? s->move_count % s->beard_growth_rate : 0;
+    for (i = 0; i < (long)sizeof(field); i++)
+        h = (h ^ ((const unsigned char *)field)[i]) * 1099511628211UL;
+    for (i = 0; i < s->world_length; i++)
+        h = (h ^ (unsigned char)s->world[i]) * 1099511628211UL;
+    return h;
 }
 
 
@@ -210,6 +267,63 @@ long get_score(const struct state *s) {
     return s->score;
 }
 
+// No sequence of moves from s scores more than this.  Every lambda left is
+// worth 50 when collected and 25 more on reaching the lift, but collecting
+// each takes a move, and reaching the lift takes at least as many moves as
+// the walk to it through anything but walls, and one more than collecting
+// every lambda left.  Neither may take more moves than are left before the
+// move limit.
+long get_score_bound(const struct state *s) {
+    DEBUG_ASSERT(s && s->analysis);
+    long remaining_count, move_count, lift_dist, bound, win_bound;
+    if (s->condition != C_NONE)
+        return s->score;
+    remaining_count = s->lambda_count - s->collected_lambda_count;
+    move_count = s->world_w * s->world_h - s->move_count;
+    bound = s->score + 49 * (remaining_count < move_count ? remaining_count : move_count);
+    lift_dist = s->analysis->lift_dist[point_to_index(s, s->robot_x, s->robot_y)];
+    if (lift_dist == -1)
+        return bound;
+    if (lift_dist < remaining_count + 1)
+        lift_dist = remaining_count + 1;
+    win_bound = s->score + 75 * remaining_count + 25 * s->collected_lambda_count - lift_dist;
+    return lift_dist <= move_count && win_bound > bound ? win_bound : bound;
+}
+
+// The water rises after the check on every flooding_rate-th move, so when a
+// row floods depends on the move count alone.  Both of these count moves
+// from the start of the map, as s->move_count does.
+
+// The first move on which a robot in row y is underwater, or LONG_MAX if the
+// water never gets there.
+long get_flooding_move_count(const struct state *s, long y) {
+    DEBUG_ASSERT(s);
+    long initial_level = get_initial_water_level(s);
+    if (y <= initial_level)
+        return 1;
+    if (!s->flooding_rate)
+        return LONG_MAX;
+    return (y - initial_level) * s->flooding_rate + 1;
+}
+
+// The last move on which a robot may arrive at (x, y) and still get out of
+// the water, were it to climb a row on every move from there, or to walk to
+// the lift through anything but walls.  Arriving any later, it drowns.
+// LONG_MAX if it can always get out, or if trampolines might lift it faster.
+long get_drowning_move_count(const struct state *s, long x, long y) {
+    DEBUG_ASSERT(s && s->analysis && is_within_world(s->world_w, s->world_h, x, y));
+    long initial_level = get_initial_water_level(s), lift_dist, deadline;
+    if (s->trampoline_count)
+        return LONG_MAX;
+    lift_dist = s->analysis->lift_dist[point_to_index(s, x, y)];
+    if (lift_dist != -1 && lift_dist <= s->robot_waterproofing)
+        return LONG_MAX;
+    if (!s->flooding_rate)
+        return y + s->robot_waterproofing > initial_level ? LONG_MAX : 0;
+    deadline = s->flooding_rate * (y + s->robot_waterproofing - initial_level) - s->robot_waterproofing;
+    return deadline > 0 ? deadline : 0;
+}
+
 char get_condition(const struct state *s) {
     DEBUG_ASSERT(s);
     return s->condition;
@@ -316,17 +430,31 @@ bool is_enterable(const struct state *s, long x, long y) {
 
 bool is_safe(const struct state *s, long x, long y) {
     DEBUG_ASSERT(s);
-    struct state *s1;
-    bool safe;
+    char above;
     if (!is_enterable(s, x, y))
-        safe = false;
-    else if (get(s, x, y + 1) == O_EMPTY || get(s, x, y + 1) == O_ROBOT) {
-        s1 = update_world_ignoring_robot(s);
-        safe = !is_rock_object(get(s1, x, y + 1));
-        free(s1);
-    } else
-        safe = true;
-    return safe;
+        return false;
+    if (get(s, x, y) != O_LIFT_OPEN && s->move_count + 1 > get_drowning_move_count(s, x, y))
+        return false;
+    above = safe_get(s, x, y + 1);
+    if (above == O_EMPTY)
+        return !will_rock_land(s, x, y + 1, s->beard_growth_rate && !((s->move_count + 1) % s->beard_growth_rate));
+    return true;
+}
+
+
+bool is_stable(const struct state *s, long x, long y) {
+    DEBUG_ASSERT(s && is_within_world(s->world_w, s->world_h, x, y));
+    return !s->disturbed && (s->analysis->flags[point_to_index(s, x, y)] & A_STABLE);
+}
+
+bool is_dead(const struct state *s, long x, long y) {
+    DEBUG_ASSERT(s && is_within_world(s->world_w, s->world_h, x, y));
+    return s->analysis->flags[point_to_index(s, x, y)] & A_DEAD;
+}
+
+long get_component(const struct state *s, long x, long y) {
+    DEBUG_ASSERT(s && is_within_world(s->world_w, s->world_h, x, y));
+    return s->analysis->component[point_to_index(s, x, y)];
 }
 
 
@@ -370,23 +498,271 @@ long safe_get_dist(const struct cost_table *ct, long x, long y) {
 // Private
 // ---------------------------------------------------------------------------
 
-void scan_input(long input_length, const char *input, long *out_world_w, long *out_world_h) {
-    DEBUG_ASSERT(input && out_world_w && out_world_h);
-    long world_w = 0, world_h = 0, w = 0, i;
-    for (i = 0; i < input_length; i++) {
-        if (input[i] != '\n')
-            w++;
-        if (i == input_length - 1 || input[i] == '\n') {
-            if (w == 0)
-                break;
-            if (w > world_w)
-                world_w = w;
-            world_h++;
-            w = 0;
+// The water level on the first move, before any flooding.
+long get_initial_water_level(const struct state *s) {
+    DEBUG_ASSERT(s);
+    return s->water_level - (s->flooding_rate ? s->move_count / s->flooding_rate : 0);
+}
+
+
+long read_chunk(int fd, char *chunk, long chunk_length) {
+    DEBUG_ASSERT(chunk);
+    long n;
+    while ((n = read(fd, chunk, chunk_length)) == -1) {
+        if (errno != EINTR)
+            PERROR_EXIT("read");
+    }
+    return n;
+}
+
+
+struct analysis *analyse(const struct state *s) {
+    DEBUG_ASSERT(s);
+    struct analysis *a;
+    if (!(a = malloc(sizeof(struct analysis) + s->world_length)))
+        PERROR_EXIT("malloc");
+    memset(a, 0, sizeof(struct analysis) + s->world_length);
+    a->world_length = s->world_length;
+    a->full_span[0] = 1;
+    a->full_span[1] = s->world_w;
+    find_components(s, a);
+    find_lift_dists(s, a);
+    find_stable_rocks(s, a);
+    find_frozen_cells(s, a);
+    find_active_spans(s, a);
+    return a;
+}
+
+// Only for an analysis made by analyse; that of a compiled map lives in the
+// map image.
+void free_analysis(struct analysis *a) {
+    DEBUG_ASSERT(a);
+    free(a->component);
+    free(a->lift_dist);
+    free(a->span_offset);
+    free(a->span);
+    free(a);
+}
+
+// Components are 8-connected, as rocks and beards move diagonally.
+void find_components(const struct state *s, struct analysis *a) {
+    DEBUG_ASSERT(s && a);
+    const long row = s->world_w + 1;
+    const long offset[8] = {-row - 1, -row, -row + 1, -1, 1, row - 1, row, row + 1};
+    long *queue, head, tail, i, j, k;
+    if (!(a->component = malloc(sizeof(long) * s->world_length)))
+        PERROR_EXIT("malloc");
+    if (!(queue = malloc(sizeof(long) * s->world_length)))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < s->world_length; i++)
+        a->component[i] = -1;
+    for (i = 0; i < s->world_length; i++) {
+        if (!is_world_index(s, i) || s->world[i] == O_WALL || a->component[i] != -1)
+            continue;
+        a->component[i] = a->component_count;
+        head = tail = 0;
+        queue[tail++] = i;
+        while (head < tail) {
+            j = queue[head++];
+            for (k = 0; k < 8; k++) {
+                if (is_world_index(s, j + offset[k]) && s->world[j + offset[k]] != O_WALL && a->component[j + offset[k]] == -1) {
+                    a->component[j + offset[k]] = a->component_count;
+                    queue[tail++] = j + offset[k];
+                }
+            }
+        }
+        a->component_count++;
+    }
+    free(queue);
+}
+
+// Every cell but a wall may be cleared at some point, so walking distances are
+// a lower bound on the number of moves to the lift.  Trampolines are followed
+// backwards from their targets.
+void find_lift_dists(const struct state *s, struct analysis *a) {
+    DEBUG_ASSERT(s && a);
+    const long row = s->world_w + 1;
+    const long offset[4] = {-row, -1, 1, row};
+    long *queue, head = 0, tail = 0, i, j, k, t, target_i;
+    if (!(a->lift_dist = malloc(sizeof(long) * s->world_length)))
+        PERROR_EXIT("malloc");
+    if (!(queue = malloc(sizeof(long) * s->world_length)))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < s->world_length; i++)
+        a->lift_dist[i] = -1;
+    if (s->lift_x) {
+        i = point_to_index(s, s->lift_x, s->lift_y);
+        a->lift_dist[i] = 0;
+        queue[tail++] = i;
+    }
+    while (head < tail) {
+        i = queue[head++];
+        for (k = 0; k < 4; k++) {
+            j = i + offset[k];
+            if (is_world_index(s, j) && s->world[j] != O_WALL && a->lift_dist[j] == -1) {
+                a->lift_dist[j] = a->lift_dist[i] + 1;
+                queue[tail++] = j;
+            }
+        }
+        for (t = 1; t <= MAX_TRAMPOLINE_COUNT; t++) {
+            if (!s->trampoline_x[t] || !(target_i = s->trampoline_index_to_target_index[t]) || !s->target_x[target_i])
+                continue;
+            if (point_to_index(s, s->target_x[target_i], s->target_y[target_i]) != i)
+                continue;
+            for (k = 0; k < 4; k++) {
+                j = point_to_index(s, s->trampoline_x[t], s->trampoline_y[t]) + offset[k];
+                if (is_world_index(s, j) && s->world[j] != O_WALL && a->lift_dist[j] == -1) {
+                    a->lift_dist[j] = a->lift_dist[i] + 1;
+                    queue[tail++] = j;
+                }
+            }
         }
     }
-    *out_world_w = world_w;
-    *out_world_h = world_h;
+    for (i = 0; i < s->world_length; i++) {
+        if (is_world_index(s, i) && a->lift_dist[i] == -1)
+            a->flags[i] |= A_DEAD;
+    }
+    free(queue);
+}
+
+// A rock is stable when nothing can ever move it: it rests on a wall or on
+// another stable rock it cannot slide off, and a wall or stable rock on one
+// side stops the robot from pushing it.  Starting from every rock, unstable
+// candidates are removed until none is left.
+void find_stable_rocks(const struct state *s, struct analysis *a) {
+    DEBUG_ASSERT(s && a);
+    const long row = s->world_w + 1;
+    const long dependant[5] = {-row - 1, -row, -row + 1, -1, 1};
+    long *queue, head = 0, tail = 0, i, j, k;
+    bool *queued;
+    if (!(queue = malloc(sizeof(long) * s->world_length)))
+        PERROR_EXIT("malloc");
+    if (!(queued = calloc(s->world_length, sizeof(bool))))
+        PERROR_EXIT("calloc");
+#define IS_SUPPORT(i) (!is_world_index(s, i) || s->world[i] == O_WALL || (a->flags[i] & A_STABLE))
+    for (i = 0; i < s->world_length; i++) {
+        if (is_world_index(s, i) && is_rock_object(s->world[i])) {
+            a->flags[i] |= A_STABLE;
+            queued[i] = true;
+            queue[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        i = queue[head++ % s->world_length];
+        queued[i] = false;
+        if (
+            IS_SUPPORT(i + row) &&
+            (IS_SUPPORT(i - 1) || IS_SUPPORT(i + 1)) &&
+            (!is_world_index(s, i + row) || s->world[i + row] == O_WALL || (
+                (IS_SUPPORT(i + 1) || IS_SUPPORT(i + row + 1)) &&
+                (IS_SUPPORT(i - 1) || IS_SUPPORT(i + row - 1))
+            ))
+        )
+            continue;
+        a->flags[i] &= ~A_STABLE;
+        for (k = 0; k < 5; k++) {
+            j = i + dependant[k];
+            if (is_world_index(s, j) && (a->flags[j] & A_STABLE) && !queued[j]) {
+                queued[j] = true;
+                queue[tail++ % s->world_length] = j;
+            }
+        }
+    }
+#undef IS_SUPPORT
+    free(queued);
+    free(queue);
+}
+
+// Walls and stable rocks never change.  Neither does a settled component the
+// robot can never reach, even through trampolines: one where no rock can move,
+// no beard can grow and no trampoline can be cleared.
+void find_frozen_cells(const struct state *s, struct analysis *a) {
+    DEBUG_ASSERT(s && a);
+    const long row = s->world_w + 1;
+    const long offset[8] = {-row - 1, -row, -row + 1, -1, 1, row - 1, row, row + 1};
+    long x, y, to_x, i, k, t, target_i;
+    bool *reachable, *unsettled, change;
+    if (!(reachable = calloc(a->component_count + 1, sizeof(bool))))
+        PERROR_EXIT("calloc");
+    if (!(unsettled = calloc(a->component_count + 1, sizeof(bool))))
+        PERROR_EXIT("calloc");
+    if (s->robot_x)
+        reachable[a->component[point_to_index(s, s->robot_x, s->robot_y)]] = true;
+    do {
+        change = false;
+        for (t = 1; t <= MAX_TRAMPOLINE_COUNT; t++) {
+            if (!s->trampoline_x[t] || !(target_i = s->trampoline_index_to_target_index[t]) || !s->target_x[target_i])
+                continue;
+            if (!reachable[a->component[point_to_index(s, s->trampoline_x[t], s->trampoline_y[t])]])
+                continue;
+            i = a->component[point_to_index(s, s->target_x[target_i], s->target_y[target_i])];
+            if (i != -1 && !reachable[i]) {
+                reachable[i] = true;
+                change = true;
+            }
+        }
+    } while (change);
+    for (i = 0; i < s->world_length; i++) {
+        if (!is_world_index(s, i) || a->component[i] == -1)
+            continue;
+        index_to_point(s, i, &x, &y);
+        if (is_rock_object(s->world[i]) && !(a->flags[i] & A_STABLE) && find_rock_fall(s, x, y, &to_x))
+            unsettled[a->component[i]] = true;
+        else if (is_valid_trampoline(s->world[i]))
+            unsettled[a->component[i]] = true;
+        else if (s->world[i] == O_BEARD && s->beard_growth_rate) {
+            for (k = 0; k < 8; k++) {
+                if (is_world_index(s, i + offset[k]) && s->world[i + offset[k]] == O_EMPTY)
+                    unsettled[a->component[i]] = true;
+            }
+        }
+    }
+    for (i = 0; i < s->world_length; i++) {
+        if (!is_world_index(s, i))
+            continue;
+        if (s->world[i] == O_WALL || (a->flags[i] & A_STABLE))
+            a->flags[i] |= A_FROZEN;
+        else if (!reachable[a->component[i]] && !unsettled[a->component[i]] && s->world[i] != O_LIFT_CLOSED)
+            a->flags[i] |= A_FROZEN;
+    }
+    free(unsettled);
+    free(reachable);
+}
+
+void find_active_spans(const struct state *s, struct analysis *a) {
+    DEBUG_ASSERT(s && a);
+    long span_count = 0, x, y;
+    if (!(a->span_offset = malloc(sizeof(long) * (s->world_h + 1))))
+        PERROR_EXIT("malloc");
+    if (!(a->span = malloc(sizeof(long) * (s->world_w + 1) * s->world_h)))
+        PERROR_EXIT("malloc");
+    for (y = 1; y <= s->world_h; y++) {
+        a->span_offset[y - 1] = span_count;
+        for (x = 1; x <= s->world_w; x++) {
+            if (a->flags[point_to_index(s, x, y)] & A_FROZEN)
+                continue;
+            if (span_count == a->span_offset[y - 1] || a->span[2 * span_count - 1] != x - 1) {
+                a->span[2 * span_count] = x;
+                span_count++;
+            }
+            a->span[2 * span_count - 1] = x;
+        }
+    }
+    a->span_offset[s->world_h] = span_count;
+}
+
+// Once the robot has been somewhere the analysis did not expect, every cell
+// is updated again.
+void get_active_spans(const struct state *s, long y, const long **out_span, long *out_span_count) {
+    DEBUG_ASSERT(s && out_span && out_span_count);
+    const struct analysis *a = s->analysis;
+    if (s->disturbed) {
+        *out_span = a->full_span;
+        *out_span_count = 1;
+        return;
+    }
+    *out_span = a->span + 2 * a->span_offset[y - 1];
+    *out_span_count = a->span_offset[y] - a->span_offset[y - 1];
 }
 
 
@@ -403,119 +779,208 @@ enum {
     K_INVALID
 };
 
-#define MAX_TOKEN_SIZE 16
-
-void copy_input_metadata(struct state *s, long input_length, const char *input) {
-    DEBUG_ASSERT(s && input);
-    char key = K_NONE, token[MAX_TOKEN_SIZE + 1];
-    long w = 0, i, trampoline_i, target_i;
-    trampoline_i = 0;
-    for (i = 0; i < input_length; i++) {
-        if (input[i] != ' ' && input[i] != '\n')
-            w++;
-        if (i == input_length - 1 || input[i] == ' ' || input[i] == '\n') {
-            if (w == 0)
-                continue;
-            if (w > MAX_TOKEN_SIZE)
-                w = MAX_TOKEN_SIZE;
-            memcpy(token, input + i - w, w);
-            token[w] = 0;
-            if (key == K_NONE) {
-                if (!strcmp(token, "Water"))
-                    key = K_WATER_LEVEL;
-                else if (!strcmp(token, "Flooding"))
-                    key = K_FLOODING_RATE;
-                else if (!strcmp(token, "Waterproof"))
-                    key = K_ROBOT_WATERPROOFING;
-                else if (!strcmp(token, "Trampoline"))
-                    key = K_TRAMPOLINE;
-                else if (!strcmp(token, "Growth"))
-                    key = K_BEARD_GROWTH_RATE;
-                else if (!strcmp(token, "Razors"))
-                    key = K_RAZOR_COUNT;
-                else {
-                    key = K_INVALID;
-                    DEBUG_LOG("found invalid metadata key '%s'\n", token);
-                }
-            } else {
-                if (key == K_WATER_LEVEL) {
-                    s->water_level = atoi(token);
-                    key = K_NONE;
-                } else if (key == K_FLOODING_RATE) {
-                    s->flooding_rate = atoi(token);
-                    key = K_NONE;
-                } else if (key == K_ROBOT_WATERPROOFING) {
-                    s->robot_waterproofing = atoi(token);
-                    key = K_NONE;
-                } else if (key == K_BEARD_GROWTH_RATE) {
-                    s->beard_growth_rate = atoi(token);
-                    key = K_NONE;
-                } else if (key == K_RAZOR_COUNT) {
-                    s->razor_count = atoi(token);
-                    key = K_NONE;
-                } else if (key == K_TRAMPOLINE) {
-                    trampoline_i = trampoline_to_index(*token);
-                    key = K_TRAMPOLINE_TARGET;
-                } else if (key == K_TRAMPOLINE_TARGET)
-                    key = K_TARGET;
-                else if (key == K_TARGET) {
-                    target_i = target_to_index(*token);
-                    s->trampoline_index_to_target_index[trampoline_i] = target_i;
-                    s->trampoline_count++;
-                    key = K_NONE;
-                } else {
-                    key = K_NONE;
-                    DEBUG_LOG("found invalid metadata value '%s'\n", token);
-                }
-            }
-            w = 0;
+void init_loader(struct loader *l) {
+    DEBUG_ASSERT(l);
+    memset(l, 0, sizeof(struct loader));
+    l->world_capacity = LOADER_CHUNK_SIZE;
+    if (!(l->s = malloc(sizeof(struct state) + l->world_capacity)))
+        PERROR_EXIT("malloc");
+    memset(l->s, 0, sizeof(struct state));
+    l->s->robot_waterproofing = DEFAULT_ROBOT_WATERPROOFING;
+    l->s->beard_growth_rate = DEFAULT_BEARD_GROWTH_RATE;
+    l->s->condition = C_NONE;
+    l->key = K_NONE;
+}
+
+// Objects whose points or number are kept in the state.
+static const bool is_noted_object[256] = {
+    [O_ROBOT] = true, [O_LAMBDA] = true, [O_HO_ROCK] = true, [O_LIFT_CLOSED] = true,
+    ['A'] = true, ['B'] = true, ['C'] = true, ['D'] = true, ['E'] = true, ['F'] = true, ['G'] = true, ['H'] = true, ['I'] = true,
+    ['1'] = true, ['2'] = true, ['3'] = true, ['4'] = true, ['5'] = true, ['6'] = true, ['7'] = true, ['8'] = true, ['9'] = true
+};
+
+// Until the height of the world is known, points are kept with the row
+// counted from the top in place of y.
+void feed_loader(struct loader *l, long chunk_length, const char *chunk) {
+    DEBUG_ASSERT(l && chunk);
+    const char *newline;
+    long i = 0, n, k;
+    while (i < chunk_length && !l->in_metadata) {
+        newline = memchr(chunk + i, '\n', chunk_length - i);
+        n = newline ? newline - (chunk + i) : chunk_length - i;
+        if (l->world_length + n > l->world_capacity) {
+            while (l->world_length + n > l->world_capacity)
+                l->world_capacity *= 2;
+            if (!(l->s = realloc(l->s, sizeof(struct state) + l->world_capacity)))
+                PERROR_EXIT("realloc");
+        }
+        memcpy(l->s->world + l->world_length, chunk + i, n);
+        for (k = 0; k < n; k++) {
+            if (is_noted_object[(unsigned char)chunk[i + k]])
+                note_loader_object(l, chunk[i + k], l->row_w + k);
         }
+        l->world_length += n;
+        l->row_w += n;
+        i += n;
+        if (!newline)
+            break;
+        i++;
+        if (l->row_w == 0)
+            l->in_metadata = true;
+        else {
+            end_loader_row(l, l->row_w);
+            l->row_w = 0;
+        }
+    }
+    for (; i < chunk_length; i++) {
+        if (chunk[i] != ' ' && chunk[i] != '\n') {
+            if (l->token_length == l->token_capacity) {
+                l->token_capacity = 2 * l->token_capacity + 16;
+                if (!(l->token = realloc(l->token, l->token_capacity + 1)))
+                    PERROR_EXIT("realloc");
+            }
+            l->token[l->token_length++] = chunk[i];
+        } else
+            end_loader_token(l);
     }
 }
 
-void copy_input(struct state *s, long input_length, const char *input) {
-    DEBUG_ASSERT(s && input);
-    long w = 0, h = 0, j = 0, i, trampoline_i, target_i;
-    for (i = 0; i < input_length; i++) {
-        if (input[i] != '\n') {
-            if (input[i] == O_ROBOT)
-                size_to_point(s->world_h, w, h, &s->robot_x, &s->robot_y);
-            else if (input[i] == O_LAMBDA || input[i] == O_HO_ROCK)
-                s->lambda_count++;
-            else if (input[i] == O_LIFT_CLOSED)
-                size_to_point(s->world_h, w, h, &s->lift_x, &s->lift_y);
-            else if (is_valid_trampoline(input[i])) {
-                trampoline_i = trampoline_to_index(input[i]);
-                size_to_point(s->world_h, w, h, &s->trampoline_x[trampoline_i], &s->trampoline_y[trampoline_i]);
-            } else if (is_valid_target(input[i])) {
-                target_i = target_to_index(input[i]);
-                size_to_point(s->world_h, w, h, &s->target_x[target_i], &s->target_y[target_i]);
-            }
-            s->world[j] = input[i];
-            j++;
-            w++;
+void note_loader_object(struct loader *l, char object, long w) {
+    DEBUG_ASSERT(l);
+    struct state *s = l->s;
+    if (object == O_ROBOT) {
+        s->robot_x = w + 1;
+        s->robot_y = s->world_h;
+    } else if (object == O_LAMBDA || object == O_HO_ROCK)
+        s->lambda_count++;
+    else if (object == O_LIFT_CLOSED) {
+        s->lift_x = w + 1;
+        s->lift_y = s->world_h;
+    } else if (is_valid_trampoline(object)) {
+        s->trampoline_x[trampoline_to_index(object)] = w + 1;
+        s->trampoline_y[trampoline_to_index(object)] = s->world_h;
+    } else if (is_valid_target(object)) {
+        s->target_x[target_to_index(object)] = w + 1;
+        s->target_y[target_to_index(object)] = s->world_h;
+    }
+}
+
+void end_loader_row(struct loader *l, long w) {
+    DEBUG_ASSERT(l);
+    if (l->s->world_h == l->row_capacity) {
+        l->row_capacity = 2 * l->row_capacity + 64;
+        if (!(l->row_width = realloc(l->row_width, sizeof(long) * l->row_capacity)))
+            PERROR_EXIT("realloc");
+    }
+    l->row_width[l->s->world_h++] = w;
+    if (w > l->s->world_w)
+        l->s->world_w = w;
+}
+
+void end_loader_token(struct loader *l) {
+    DEBUG_ASSERT(l);
+    struct state *s = l->s;
+    char *token = l->token;
+    if (!l->token_length)
+        return;
+    token[l->token_length] = 0;
+    l->token_length = 0;
+    if (l->key == K_NONE) {
+        if (!strcmp(token, "Water"))
+            l->key = K_WATER_LEVEL;
+        else if (!strcmp(token, "Flooding"))
+            l->key = K_FLOODING_RATE;
+        else if (!strcmp(token, "Waterproof"))
+            l->key = K_ROBOT_WATERPROOFING;
+        else if (!strcmp(token, "Trampoline"))
+            l->key = K_TRAMPOLINE;
+        else if (!strcmp(token, "Growth"))
+            l->key = K_BEARD_GROWTH_RATE;
+        else if (!strcmp(token, "Razors"))
+            l->key = K_RAZOR_COUNT;
+        else {
+            l->key = K_INVALID;
+            DEBUG_LOG("found invalid metadata key '%s'\n", token);
         }
-        if (i == input_length - 1 || input[i] == '\n') {
-            if (w == 0)
-                break;
-            while (w < s->world_w) {
-                s->world[j++] = O_EMPTY;
-                w++;
-            }
-            s->world[j] = '\n';
-            j++;
-            h++;
-            w = 0;
+    } else {
+        if (l->key == K_WATER_LEVEL) {
+            s->water_level = atol(token);
+            l->key = K_NONE;
+        } else if (l->key == K_FLOODING_RATE) {
+            s->flooding_rate = atol(token);
+            l->key = K_NONE;
+        } else if (l->key == K_ROBOT_WATERPROOFING) {
+            s->robot_waterproofing = atol(token);
+            l->key = K_NONE;
+        } else if (l->key == K_BEARD_GROWTH_RATE) {
+            s->beard_growth_rate = atol(token);
+            l->key = K_NONE;
+        } else if (l->key == K_RAZOR_COUNT) {
+            s->razor_count = atol(token);
+            l->key = K_NONE;
+        } else if (l->key == K_TRAMPOLINE) {
+            l->trampoline_i = trampoline_to_index(*token);
+            l->key = K_TRAMPOLINE_TARGET;
+        } else if (l->key == K_TRAMPOLINE_TARGET)
+            l->key = K_TARGET;
+        else if (l->key == K_TARGET) {
+            s->trampoline_index_to_target_index[l->trampoline_i] = target_to_index(*token);
+            s->trampoline_count++;
+            l->key = K_NONE;
+        } else {
+            l->key = K_NONE;
+            DEBUG_LOG("found invalid metadata value '%s'\n", token);
         }
     }
-    i++;
-    s->world[j] = 0;
-    copy_input_metadata(s, input_length - i, input + i);
+}
+
+// Rows are stored unpadded as they arrive.  Once the widest is known, they
+// are padded in place from the last, which never overwrites a row not yet
+// moved.
+struct state *finish_loader(struct loader *l) {
+    DEBUG_ASSERT(l);
+    struct state *s;
+    long from, to, h, t;
+    if (l->in_metadata)
+        end_loader_token(l);
+    else if (l->row_w)
+        end_loader_row(l, l->row_w);
+    s = l->s;
+    s->world_length = (s->world_w + 1) * s->world_h + 1;
+    if (!(s = realloc(s, sizeof(struct state) + s->world_length)))
+        PERROR_EXIT("realloc");
+    from = l->world_length;
+    for (h = s->world_h - 1; h >= 0; h--) {
+        from -= l->row_width[h];
+        to = h * (s->world_w + 1);
+        memmove(s->world + to, s->world + from, l->row_width[h]);
+        memset(s->world + to + l->row_width[h], O_EMPTY, s->world_w - l->row_width[h]);
+        s->world[to + s->world_w] = '\n';
+    }
+    s->world[s->world_length - 1] = 0;
+    if (s->robot_x)
+        s->robot_y = s->world_h - s->robot_y;
+    if (s->lift_x)
+        s->lift_y = s->world_h - s->lift_y;
+    for (t = 1; t <= MAX_TRAMPOLINE_COUNT; t++) {
+        if (s->trampoline_x[t])
+            s->trampoline_y[t] = s->world_h - s->trampoline_y[t];
+        if (s->target_x[t])
+            s->target_y[t] = s->world_h - s->target_y[t];
+    }
+    free(l->row_width);
+    free(l->token);
+    s->analysis = analyse(s);
+    return s;
 }
 
 
 void teleport_robot(struct state *s, long x, long y) {
     DEBUG_ASSERT(s);
+    if (s->analysis->flags[point_to_index(s, x, y)] & A_FROZEN) {
+        s->disturbed = true;
+        DEBUG_LOG("robot disturbed a frozen region at (%ld, %ld)\n", x, y);
+    }
     put(s, s->robot_x, s->robot_y, O_EMPTY);
     s->robot_x = x;
     s->robot_y = y;
@@ -668,19 +1133,60 @@ void shave_beard(struct state *s, long x, long y) {
         DEBUG_LOG("robot attempted to shave without a razor\n");
 }
 
-void grow_beard(struct state *s, const struct state *s0, long x, long y) {
-    DEBUG_ASSERT(s && s0);
-    long i, j;
-    for (i = -1; i <= 1; i++) {
-        for (j = -1; j <= 1; j++) {
-            if (get(s0, x + i, y + j) == O_EMPTY) {
-                put(s, x + i, y + j, O_BEARD);
-                DEBUG_LOG("beard grew at (%ld, %ld)\n", x, y);
+void init_beard_masks(struct beard_masks *m, const struct state *s0) {
+    DEBUG_ASSERT(m && s0);
+    m->word_count = (s0->world_w + 1) / BEARD_MASK_BITS + 1;
+    if (!(m->beard = calloc(2 * (s0->world_h + 2) * m->word_count, sizeof(long))))
+        PERROR_EXIT("calloc");
+    m->empty = m->beard + (s0->world_h + 2) * m->word_count;
+}
+
+// Beards grow into every cell that was empty and next to a beard, which is
+// the beard rows above and below or-ed together, spread a bit to each side,
+// and masked by the empty row.  Only a rock can have landed in such a cell
+// meanwhile, and it stays unless a beard came after it in update_world's
+// order.
+void grow_beards(struct state *s, const struct state *s0, const struct beard_masks *m) {
+    DEBUG_ASSERT(s && s0 && m);
+    const long n = m->word_count;
+    unsigned long previous, around, next, grown;
+    long x, y, k;
+    for (y = 1; y <= s->world_h; y++) {
+        previous = 0;
+        around = m->beard[(y - 1) * n] | m->beard[y * n] | m->beard[(y + 1) * n];
+        for (k = 0; k < n; k++) {
+            next = k + 1 < n ? m->beard[(y - 1) * n + k + 1] | m->beard[y * n + k + 1] | m->beard[(y + 1) * n + k + 1] : 0;
+            grown = (around | around << 1 | around >> 1 | previous >> (BEARD_MASK_BITS - 1) | next << (BEARD_MASK_BITS - 1)) & m->empty[y * n + k];
+            for (; grown; grown &= grown - 1) {
+                x = k * BEARD_MASK_BITS + __builtin_ctzl(grown);
+                if (get(s, x, y) == O_EMPTY || is_last_write_beard(s0, x, y)) {
+                    put(s, x, y, O_BEARD);
+                    DEBUG_LOG("beard grew at (%ld, %ld)\n", x, y);
+                }
             }
+            previous = around;
+            around = next;
         }
     }
 }
 
+// Rocks write to the empty cell at (x, y) only from the row above, after any
+// beard below, so only the row above decides which came last.
+bool is_last_write_beard(const struct state *s0, long x, long y) {
+    DEBUG_ASSERT(s0);
+    bool beard = false;
+    long i, to_x;
+    char source;
+    for (i = x - 1; i <= x + 1; i++) {
+        source = safe_get(s0, i, y + 1);
+        if (source == O_BEARD)
+            beard = true;
+        else if (is_rock_object(source) && find_rock_fall(s0, i, y + 1, &to_x) && to_x == x)
+            beard = false;
+    }
+    return beard;
+}
+
 
 void drop_rock(struct state *s, const struct state *s0, char rock, long x, long y, bool ignore_robot) {
     DEBUG_ASSERT(s && s0 && is_rock_object(rock));
@@ -702,39 +1208,53 @@ void drop_rock(struct state *s, const struct state *s0, char rock, long x, long
 void update_world(struct state *s, const struct state *s0, bool ignore_robot) {
     DEBUG_ASSERT(s && s0);
     DEBUG_ASSERT(s->condition == C_NONE);
-    long x, y;
+    const long *span;
+    struct beard_masks m;
+    bool grow;
+    long span_count, x, y, i;
+    if ((grow = s->beard_growth_rate && !(s->move_count % s->beard_growth_rate)))
+        init_beard_masks(&m, s0);
     for (y = 1; y <= s->world_h; y++) {
-        for (x = 1; x <= s->world_w; x++) {
-            char object;
-            object = get(s0, x, y);
-            if (is_rock_object(object)) {
-                char below;
-                below = get(s0, x, y - 1);
-                if (below == O_EMPTY) {
-                    put(s, x, y, O_EMPTY);
-                    put(s, x, y - 1, object);
-                    drop_rock(s, s0, object, x, y - 1, ignore_robot);
-                } else if (is_rock_object(below) && get(s0, x + 1, y) == O_EMPTY && get(s0, x + 1, y - 1) == O_EMPTY) {
-                    put(s, x, y, O_EMPTY);
-                    put(s, x + 1, y - 1, object);
-                    drop_rock(s, s0, object, x + 1, y - 1, ignore_robot);
-                } else if (is_rock_object(below) && get(s0, x - 1, y) == O_EMPTY && get(s0, x - 1, y - 1) == O_EMPTY) {
-                    put(s, x, y, O_EMPTY);
-                    put(s, x - 1, y - 1, object);
-                    drop_rock(s, s0, object, x - 1, y - 1, ignore_robot);
-                } else if (below == O_LAMBDA && get(s0, x + 1, y) == O_EMPTY && get(s0, x + 1, y - 1) == O_EMPTY) {
-                    put(s, x, y, O_EMPTY);
-                    put(s, x + 1, y - 1, object);
-                    drop_rock(s, s0, object, x + 1, y - 1, ignore_robot);
+        get_active_spans(s0, y, &span, &span_count);
+        for (i = 0; i < 2 * span_count; i += 2) {
+            for (x = span[i]; x <= span[i + 1]; x++) {
+                char object;
+                object = get(s0, x, y);
+                if (grow && object == O_BEARD)
+                    put_beard_mask_bit(m.beard, m.word_count, x, y);
+                else if (grow && object == O_EMPTY)
+                    put_beard_mask_bit(m.empty, m.word_count, x, y);
+                if (is_rock_object(object)) {
+                    char below;
+                    below = get(s0, x, y - 1);
+                    if (below == O_EMPTY) {
+                        put(s, x, y, O_EMPTY);
+                        put(s, x, y - 1, object);
+                        drop_rock(s, s0, object, x, y - 1, ignore_robot);
+                    } else if (is_rock_object(below) && get(s0, x + 1, y) == O_EMPTY && get(s0, x + 1, y - 1) == O_EMPTY) {
+                        put(s, x, y, O_EMPTY);
+                        put(s, x + 1, y - 1, object);
+                        drop_rock(s, s0, object, x + 1, y - 1, ignore_robot);
+                    } else if (is_rock_object(below) && get(s0, x - 1, y) == O_EMPTY && get(s0, x - 1, y - 1) == O_EMPTY) {
+                        put(s, x, y, O_EMPTY);
+                        put(s, x - 1, y - 1, object);
+                        drop_rock(s, s0, object, x - 1, y - 1, ignore_robot);
+                    } else if (below == O_LAMBDA && get(s0, x + 1, y) == O_EMPTY && get(s0, x + 1, y - 1) == O_EMPTY) {
+                        put(s, x, y, O_EMPTY);
+                        put(s, x + 1, y - 1, object);
+                        drop_rock(s, s0, object, x + 1, y - 1, ignore_robot);
+                    }
+                } else if (object == O_LIFT_CLOSED && s0->collected_lambda_count == s0->lambda_count) {
+                    put(s, x, y, O_LIFT_OPEN);
+                    DEBUG_LOG("lift opened\n");
                 }
-            } else if (object == O_BEARD && s->beard_growth_rate && !(s->move_count % s->beard_growth_rate))
-                grow_beard(s, s0, x, y);
-            else if (object == O_LIFT_CLOSED && s0->collected_lambda_count == s0->lambda_count) {
-                put(s, x, y, O_LIFT_OPEN);
-                DEBUG_LOG("lift opened\n");
             }
         }
     }
+    if (grow) {
+        grow_beards(s, s0, &m);
+        free(m.beard);
+    }
     if (s->condition != C_NONE)
         return;
     if (!ignore_robot && s0->robot_y <= s->water_level) {
@@ -757,6 +1277,45 @@ void update_world(struct state *s, const struct state *s0, bool ignore_robot) {
 }
 
 
+bool find_rock_fall(const struct state *s, long x, long y, long *out_x) {
+    DEBUG_ASSERT(s && out_x);
+    char below;
+    below = safe_get(s, x, y - 1);
+    if (below == O_EMPTY)
+        *out_x = x;
+    else if (is_rock_object(below) && safe_get(s, x + 1, y) == O_EMPTY && safe_get(s, x + 1, y - 1) == O_EMPTY)
+        *out_x = x + 1;
+    else if (is_rock_object(below) && safe_get(s, x - 1, y) == O_EMPTY && safe_get(s, x - 1, y - 1) == O_EMPTY)
+        *out_x = x - 1;
+    else if (below == O_LAMBDA && safe_get(s, x + 1, y) == O_EMPTY && safe_get(s, x + 1, y - 1) == O_EMPTY)
+        *out_x = x + 1;
+    else
+        return false;
+    return true;
+}
+
+// Replays, in update_world's scan order, every rock and beard that could
+// write to the empty cell at (x, y), without copying the state.
+bool will_rock_land(const struct state *s, long x, long y, bool grow_beard) {
+    DEBUG_ASSERT(s && safe_get(s, x, y) == O_EMPTY);
+    char object = O_EMPTY, source;
+    long i, j, to_x;
+    for (j = y - 1; j <= y + 1; j++) {
+        for (i = x - 1; i <= x + 1; i++) {
+            source = safe_get(s, i, j);
+            if (source == O_BEARD && grow_beard)
+                object = O_BEARD;
+            else if (j == y + 1 && is_rock_object(source) && find_rock_fall(s, i, j, &to_x) && to_x == x) {
+                object = source;
+                if (source == O_HO_ROCK && s->condition == C_NONE && safe_get(s, x, y - 1) != O_EMPTY)
+                    object = O_LAMBDA;
+            }
+        }
+    }
+    return is_rock_object(object);
+}
+
+
 long calculate_cost(const struct state *s, long step_x, long step_y, long stage) {
     if (safe_get(s, step_x, step_y) == O_LAMBDA)
         return 1;
@@ -808,3 +1367,11 @@ void run_dijkstra(struct cost_table *ct, const struct state *s) {
     } while (!change);
     free(s1);
 }
+
+
+long count_online_cpus(void) {
+    long cpu_count;
+    if ((cpu_count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        cpu_count = 1;
+    return cpu_count;
+}
@@ -36,8 +36,10 @@
 
 struct state *new(long input_length, const char *input);
 struct state *new_from_file(const char *path);
+struct state *new_from_fd(int fd);
 struct state *copy(const struct state *s0);
 bool equal(const struct state *s1, const struct state *s2);
+unsigned long hash(const struct state *s);
 
 void dump(const struct state *s);
 
@@ -58,6 +60,9 @@ bool get_target_point(const struct state *s, char target, long *out_target_x, lo
 bool get_trampoline_target(const struct state *s, char trampoline, char *out_target);
 long get_move_count(const struct state *s);
 long get_score(const struct state *s);
+long get_score_bound(const struct state *s);
+long get_flooding_move_count(const struct state *s, long y);
+long get_drowning_move_count(const struct state *s, long x, long y);
 char get_condition(const struct state *s);
 char safe_get(const struct state *s, long x, long y);
 
@@ -72,6 +77,10 @@ void imagine_step(const struct state *s, long x, long y, char move, long *out_x,
 bool is_enterable(const struct state *s, long x, long y);
 bool is_safe(const struct state *s, long x, long y);
 
+bool is_stable(const struct state *s, long x, long y);
+bool is_dead(const struct state *s, long x, long y);
+long get_component(const struct state *s, long x, long y);
+
 struct cost_table *build_cost_table(const struct state *s, long x, long y);
 long safe_get_cost(const struct cost_table *ct, long x, long y);
 long safe_get_dist(const struct cost_table *ct, long x, long y);
@@ -111,14 +120,45 @@ long safe_get_dist(const struct cost_table *ct, long x, long y);
 #define DEFAULT_BEARD_GROWTH_RATE 25
 #define MAX_TRAMPOLINE_COUNT 9
 
+#define LOADER_CHUNK_SIZE 65536
+
 
 #define IGNORE_ROBOT        true
 #define DO_NOT_IGNORE_ROBOT false
 
 #define MAX_COST LONG_MAX
 
+#define BEARD_MASK_BITS (8 * sizeof(unsigned long))
+
+#define A_STABLE           1
+#define A_DEAD             2
+#define A_FROZEN           4
+
+
+// Computed once per map and shared by every state derived from it, so it is
+// never freed.
+struct analysis {
+    long world_length;
+    long component_count;
+    long *component;
+    long *lift_dist;
+    long *span_offset;
+    long *span;
+    long full_span[2];
+    char flags[];
+};
+
+// One bit per cell of a world, a row at a time from y = 0 to world_h + 1,
+// for the beards and the empty cells that update_world sees on a growth
+// move.
+struct beard_masks {
+    long word_count;
+    unsigned long *beard;
+    unsigned long *empty;
+};
 
 struct state {
+    const struct analysis *analysis;
     long world_w, world_h;
     long robot_x, robot_y;
     long lift_x, lift_y;
@@ -137,10 +177,27 @@ struct state {
     long move_count;
     long score;
     char condition;
+    bool disturbed;
     long world_length;
     char world[];
 };
 
+// Builds a state from map text fed to it in chunks of any size, in one pass.
+// The world is stored unpadded after room for the state, growing as needed,
+// and metadata tokens may be of any length.
+struct loader {
+    struct state *s;
+    long world_length, world_capacity;
+    long *row_width;
+    long row_capacity;
+    long row_w;
+    bool in_metadata;
+    char key;
+    long trampoline_i;
+    char *token;
+    long token_length, token_capacity;
+};
+
 struct cost_table {
     long world_w, world_h;
     long world_length;
@@ -196,6 +253,16 @@ inline long point_to_index(const struct state *s, long x, long y) {
     return i;
 }
 
+inline void index_to_point(const struct state *s, long i, long *out_x, long *out_y) {
+    DEBUG_ASSERT(s && out_x && out_y);
+    size_to_point(s->world_h, i % (s->world_w + 1), i / (s->world_w + 1), out_x, out_y);
+}
+
+inline bool is_world_index(const struct state *s, long i) {
+    DEBUG_ASSERT(s);
+    return i >= 0 && i < s->world_length - 1 && s->world[i] != '\n';
+}
+
 inline long point_to_cost_table_index(const struct cost_table *ct, long x, long y) {
     DEBUG_ASSERT(ct);
     long w, h, i;
@@ -235,6 +302,11 @@ inline void put(struct state *s, long x, long y, char object) {
     s->world[point_to_index(s, x, y)] = object;
 }
 
+inline void put_beard_mask_bit(unsigned long *mask, long word_count, long x, long y) {
+    DEBUG_ASSERT(mask);
+    mask[y * word_count + x / BEARD_MASK_BITS] |= 1UL << (x % BEARD_MASK_BITS);
+}
+
 inline long get_cost(const struct cost_table *ct, long x, long y) {
     DEBUG_ASSERT(ct && is_within_world(ct->world_w, ct->world_h, x, y));
     return ct->world_cost[point_to_cost_table_index(ct, x, y)];
@@ -256,10 +328,25 @@ inline void put_dist(struct cost_table *ct, long x, long y, long dist) {
 }
 
 
-void scan_input(long input_length, const char *input, long *out_world_w, long *out_world_h);
+long get_initial_water_level(const struct state *s);
+
+long read_chunk(int fd, char *chunk, long chunk_length);
 
-void copy_input_metadata(struct state *s, long input_length, const char *input);
-void copy_input(struct state *s, long input_length, const char *input);
+struct analysis *analyse(const struct state *s);
+void free_analysis(struct analysis *a);
+void find_components(const struct state *s, struct analysis *a);
+void find_lift_dists(const struct state *s, struct analysis *a);
+void find_stable_rocks(const struct state *s, struct analysis *a);
+void find_frozen_cells(const struct state *s, struct analysis *a);
+void find_active_spans(const struct state *s, struct analysis *a);
+void get_active_spans(const struct state *s, long y, const long **out_span, long *out_span_count);
+
+void init_loader(struct loader *l);
+void feed_loader(struct loader *l, long chunk_length, const char *chunk);
+void note_loader_object(struct loader *l, char object, long w);
+void end_loader_row(struct loader *l, long w);
+void end_loader_token(struct loader *l);
+struct state *finish_loader(struct loader *l);
 
 void teleport_robot(struct state *s, long x, long y);
 void move_robot(struct state *s, long x, long y);
@@ -270,10 +357,16 @@ void clear_similar_trampolines(struct state *s, char trampoline);
 void execute_move(struct state *s, char move);
 
 void shave_beard(struct state *s, long x, long y);
-void grow_beard(struct state *s, const struct state *s0, long x, long y);
+void init_beard_masks(struct beard_masks *m, const struct state *s0);
+void grow_beards(struct state *s, const struct state *s0, const struct beard_masks *m);
+bool is_last_write_beard(const struct state *s0, long x, long y);
 
 void drop_rock(struct state *s, const struct state *s0, char rock, long x, long y, bool ignore_robot);
 void update_world(struct state *s, const struct state *t, bool ignore_robot);
+bool find_rock_fall(const struct state *s, long x, long y, long *out_x);
+bool will_rock_land(const struct state *s, long x, long y, bool grow_beard);
 
 long calculate_cost(const struct state *s, long step_x, long step_y, long stage);
 void run_dijkstra(struct cost_table *ct, const struct state *s);
+
+long count_online_cpus(void);
@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libvm.h"
+#include "search.h"
+#include "optimize.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// Tries to raise the score of the moves from s0 for time_limit seconds: by
+// cutting out loops the robot walks, splicing shortest paths in place of
+// detours, and by small random edits.  Each thread replays its candidates
+// from the checkpoint before the edit, and on maps where nothing depends on
+// the move count, stops as soon as the candidate rejoins the moves it came
+// from.  Returns the best moves found, to be freed with free().
+char *optimize(const struct state *s0, const char *moves, long thread_count, double time_limit, long *out_candidate_count) {
+    DEBUG_ASSERT(s0 && moves);
+    struct optimizer o;
+    struct state *s, *scratch;
+    char *best_moves;
+    long move_count, i;
+    if (thread_count <= 0)
+        thread_count = count_online_cpus();
+    memset(&o, 0, sizeof(struct optimizer));
+    o.s0 = s0;
+    o.state_size = (sizeof(struct state) + s0->world_length + 15) & ~15L;
+    move_count = strspn(moves, "LRUDWAS");
+    o.interval = move_count * o.state_size / OPTIMIZE_CHECKPOINT_MEMORY + 1;
+    if (o.interval < OPTIMIZE_CHECKPOINT_INTERVAL)
+        o.interval = OPTIMIZE_CHECKPOINT_INTERVAL;
+    o.is_timeless = !s0->flooding_rate && !memchr(s0->world, O_BEARD, s0->world_length);
+    o.deadline = get_optimizer_time() + time_limit;
+    o.thread_count = thread_count;
+    pthread_mutex_init(&o.best_mutex, NULL);
+    if (!(s = malloc(o.state_size)) || !(scratch = malloc(o.state_size)))
+        PERROR_EXIT("malloc");
+    o.best = build_solution(&o, NULL, moves, move_count, 0, s, scratch);
+    free(s);
+    free(scratch);
+    DEBUG_LOG("optimize started from score %ld in %ld moves\n", o.best->score, o.best->move_count);
+    if (!(o.worker = calloc(thread_count, sizeof(struct optimizer_worker))))
+        PERROR_EXIT("calloc");
+    for (i = 0; i < thread_count; i++) {
+        o.worker[i].shared = &o;
+        o.worker[i].seed = i + 1;
+        if (!(o.worker[i].s = malloc(o.state_size)) || !(o.worker[i].scratch = malloc(o.state_size)))
+            PERROR_EXIT("malloc");
+        if (!(o.worker[i].edit.inserted = malloc(MAX_LOOP_LENGTH + 1)))
+            PERROR_EXIT("malloc");
+        if (!(o.worker[i].queue = malloc(s0->world_length * sizeof(long))) || !(o.worker[i].visit = calloc(s0->world_length, sizeof(long))) || !(o.worker[i].came_by = malloc(s0->world_length)))
+            PERROR_EXIT("malloc");
+        if (pthread_create(&o.worker[i].thread, NULL, run_optimizer_worker, &o.worker[i]))
+            PERROR_EXIT("pthread_create");
+    }
+    if (out_candidate_count)
+        *out_candidate_count = 0;
+    for (i = 0; i < thread_count; i++) {
+        pthread_join(o.worker[i].thread, NULL);
+        if (out_candidate_count)
+            *out_candidate_count += o.worker[i].candidate_count;
+        free(o.worker[i].s);
+        free(o.worker[i].scratch);
+        free(o.worker[i].edit.inserted);
+        free(o.worker[i].candidate);
+        free(o.worker[i].queue);
+        free(o.worker[i].visit);
+        free(o.worker[i].came_by);
+    }
+    DEBUG_LOG("optimize finished with score %ld in %ld moves\n", o.best->score, o.best->move_count);
+    if (!(best_moves = strdup(o.best->moves)))
+        PERROR_EXIT("strdup");
+    release_solution(&o, o.best);
+    free(o.worker);
+    pthread_mutex_destroy(&o.best_mutex);
+    return best_moves;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+double get_optimizer_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+// Replays the moves from the last checkpoint of old before at, as the moves
+// before at are the same, and cuts them off where the game ends.
+struct solution *build_solution(struct optimizer *o, const struct solution *old, const char *moves, long move_count, long at, struct state *s, struct state *scratch) {
+    DEBUG_ASSERT(o && moves && s && scratch && (!old || at < old->move_count));
+    struct solution *sol;
+    long c, i;
+    if (!(sol = malloc(sizeof(struct solution))))
+        PERROR_EXIT("malloc");
+    sol->reference_count = 1;
+    if (!(sol->moves = malloc(move_count + 1)) || !(sol->robot = malloc((move_count + 1) * sizeof(long))) || !(sol->checkpoint = malloc((move_count / o->interval + 1) * o->state_size)))
+        PERROR_EXIT("malloc");
+    memcpy(sol->moves, moves, move_count);
+    c = old ? at / o->interval : 0;
+    if (old) {
+        memcpy(sol->checkpoint, old->checkpoint, (c + 1) * o->state_size);
+        memcpy(sol->robot, old->robot, (c * o->interval + 1) * sizeof(long));
+        memcpy(s, get_checkpoint(o, old, c), o->state_size);
+    } else {
+        memcpy(sol->checkpoint, o->s0, sizeof(struct state) + o->s0->world_length);
+        sol->robot[0] = point_to_index(o->s0, o->s0->robot_x, o->s0->robot_y);
+        memcpy(s, o->s0, sizeof(struct state) + o->s0->world_length);
+    }
+    sol->checkpoint_count = c + 1;
+    for (i = c * o->interval; i < move_count && s->condition == C_NONE; ) {
+        apply_move(s, scratch, s, moves[i++]);
+        sol->robot[i] = point_to_index(s, s->robot_x, s->robot_y);
+        if (!(i % o->interval) && s->condition == C_NONE)
+            memcpy(sol->checkpoint + sol->checkpoint_count++ * o->state_size, s, o->state_size);
+    }
+    sol->move_count = i;
+    sol->moves[i] = 0;
+    sol->score = s->score;
+    return sol;
+}
+
+struct solution *acquire_solution(struct optimizer *o) {
+    DEBUG_ASSERT(o);
+    struct solution *sol;
+    pthread_mutex_lock(&o->best_mutex);
+    sol = o->best;
+    sol->reference_count++;
+    pthread_mutex_unlock(&o->best_mutex);
+    return sol;
+}
+
+void release_solution(struct optimizer *o, struct solution *sol) {
+    DEBUG_ASSERT(o && sol);
+    long reference_count;
+    pthread_mutex_lock(&o->best_mutex);
+    reference_count = --sol->reference_count;
+    pthread_mutex_unlock(&o->best_mutex);
+    if (reference_count)
+        return;
+    free(sol->moves);
+    free(sol->robot);
+    free(sol->checkpoint);
+    free(sol);
+}
+
+// Another worker may have installed a better solution in the meantime.
+void install_solution(struct optimizer *o, struct solution *sol) {
+    DEBUG_ASSERT(o && sol);
+    struct solution *old = sol;
+    pthread_mutex_lock(&o->best_mutex);
+    if (sol->score > o->best->score) {
+        old = o->best;
+        o->best = sol;
+        DEBUG_LOG("optimize improved to score %ld in %ld moves\n", sol->score, sol->move_count);
+    }
+    pthread_mutex_unlock(&o->best_mutex);
+    release_solution(o, old);
+}
+
+
+// Everything but the move count and the score, which are all that tell apart
+// two such states on a timeless map.
+bool is_same_but_for_time(const struct state *s1, const struct state *s2) {
+    DEBUG_ASSERT(s1 && s2 && s1->world_length == s2->world_length);
+    return !memcmp((const char *)s1 + offsetof(struct state, world_w), (const char *)s2 + offsetof(struct state, world_w), offsetof(struct state, move_count) - offsetof(struct state, world_w)) &&
+        s1->condition == s2->condition && s1->disturbed == s2->disturbed && !memcmp(s1->world, s2->world, s1->world_length);
+}
+
+void replay_to_edit(struct optimizer_worker *w, const struct solution *sol, long at) {
+    DEBUG_ASSERT(w && sol && at < sol->move_count);
+    struct optimizer *o = w->shared;
+    long i;
+    i = at / o->interval;
+    memcpy(w->s, get_checkpoint(o, sol, i), o->state_size);
+    for (i *= o->interval; i < at; i++)
+        apply_move(w->s, w->scratch, w->s, sol->moves[i]);
+}
+
+// Breadth-first search for a walk of fewer than max_length moves from the
+// robot to the target index, through cells it could enter without pushing
+// anything, as the world stands.  Rocks falling on the way are left to the
+// replay to find out.
+bool find_shortcut(struct optimizer_worker *w, long target, long max_length) {
+    DEBUG_ASSERT(w && max_length <= MAX_LOOP_LENGTH);
+    static const char move[4] = { M_LEFT, M_RIGHT, M_UP, M_DOWN };
+    const struct state *s = w->s;
+    long step[4] = { -1, 1, -(s->world_w + 1), s->world_w + 1 };
+    long head = 0, tail = 0, level_end, length = 0, i, j, k;
+    char object;
+    w->visit_stamp++;
+    i = point_to_index(s, s->robot_x, s->robot_y);
+    w->visit[i] = w->visit_stamp;
+    w->queue[tail++] = i;
+    while (head < tail && length < max_length - 1) {
+        length++;
+        for (level_end = tail; head < level_end; head++) {
+            i = w->queue[head];
+            for (k = 0; k < 4; k++) {
+                j = i + step[k];
+                if (!is_world_index(s, j) || w->visit[j] == w->visit_stamp)
+                    continue;
+                object = s->world[j];
+                if (j != target && object != O_EMPTY && object != O_EARTH && object != O_LAMBDA && object != O_RAZOR && object != O_LIFT_OPEN)
+                    continue;
+                w->visit[j] = w->visit_stamp;
+                w->came_by[j] = k;
+                if (j == target) {
+                    w->edit.inserted_count = length;
+                    for (; length--; j -= step[(long)w->came_by[j]])
+                        w->edit.inserted[length] = move[(long)w->came_by[j]];
+                    return true;
+                }
+                w->queue[tail++] = j;
+            }
+        }
+    }
+    return false;
+}
+
+// Picks where to edit, replays the solution up to there and fills in the
+// edit.  Returns false when the kind picked has nothing to offer there.
+bool choose_edit(struct optimizer_worker *w, const struct solution *sol) {
+    DEBUG_ASSERT(w && sol && sol->move_count);
+    static const char opposite[256] = { [M_LEFT] = M_RIGHT, [M_RIGHT] = M_LEFT, [M_UP] = M_DOWN, [M_DOWN] = M_UP };
+    struct edit *e = &w->edit;
+    long kind, i, j;
+    kind = rand_r(&w->seed) % EDIT_KIND_COUNT;
+    e->at = rand_r(&w->seed) % sol->move_count;
+    e->inserted_count = 0;
+    switch (kind) {
+    case E_LOOP:
+        for (i = e->at + 1, j = -1; i <= sol->move_count && i <= e->at + MAX_LOOP_LENGTH; i++)
+            if (sol->robot[i] == sol->robot[e->at])
+                j = i;
+        if (j == -1)
+            return false;
+        e->removed_count = j - e->at;
+        break;
+    case E_SPLICE:
+        e->removed_count = 2 + rand_r(&w->seed) % (MAX_SPLICE_LENGTH - 1);
+        if (e->at + e->removed_count > sol->move_count)
+            e->removed_count = sol->move_count - e->at;
+        replay_to_edit(w, sol, e->at);
+        return find_shortcut(w, sol->robot[e->at + e->removed_count], e->removed_count);
+    case E_CUT:
+        e->removed_count = 1 + rand_r(&w->seed) % MAX_CUT_LENGTH;
+        break;
+    case E_CANCEL:
+        if (!opposite[(unsigned char)sol->moves[e->at]])
+            return false;
+        for (j = e->at + 1; j < sol->move_count && j <= e->at + MAX_CUT_LENGTH && sol->moves[j] != opposite[(unsigned char)sol->moves[e->at]]; j++)
+            ;
+        if (j == sol->move_count || j > e->at + MAX_CUT_LENGTH)
+            return false;
+        e->removed_count = j - e->at + 1;
+        e->inserted_count = j - e->at - 1;
+        memcpy(e->inserted, sol->moves + e->at + 1, e->inserted_count);
+        break;
+    case E_REPLACE:
+        e->removed_count = 1 + rand_r(&w->seed) % 4;
+        e->inserted_count = rand_r(&w->seed) % (e->removed_count + 1);
+        for (i = 0; i < e->inserted_count; i++)
+            e->inserted[i] = OPTIMIZE_MOVES[rand_r(&w->seed) % (sizeof(OPTIMIZE_MOVES) - 1)];
+        break;
+    case E_SWAP:
+        if (e->at + 1 == sol->move_count || sol->moves[e->at] == sol->moves[e->at + 1])
+            return false;
+        e->removed_count = e->inserted_count = 2;
+        e->inserted[0] = sol->moves[e->at + 1];
+        e->inserted[1] = sol->moves[e->at];
+        break;
+    default:
+        e->removed_count = sol->move_count - e->at;
+        e->inserted[e->inserted_count++] = M_ABORT;
+    }
+    if (e->at + e->removed_count > sol->move_count)
+        e->removed_count = sol->move_count - e->at;
+    replay_to_edit(w, sol, e->at);
+    return true;
+}
+
+// Plays the edit and the moves after it from where replay_to_edit left off,
+// and returns the score they end with.
+long finish_candidate(struct optimizer_worker *w, const struct solution *sol) {
+    DEBUG_ASSERT(w && sol);
+    struct optimizer *o = w->shared;
+    const struct edit *e = &w->edit;
+    const struct state *checkpoint;
+    long i;
+    w->candidate_count++;
+    for (i = 0; i < e->inserted_count && w->s->condition == C_NONE; i++)
+        apply_move(w->s, w->scratch, w->s, e->inserted[i]);
+    for (i = e->at + e->removed_count; i < sol->move_count && w->s->condition == C_NONE; i++) {
+        if (o->is_timeless && !(i % o->interval) && i / o->interval < sol->checkpoint_count) {
+            checkpoint = get_checkpoint(o, sol, i / o->interval);
+            if (is_same_but_for_time(w->s, checkpoint))
+                return sol->score + w->s->score - checkpoint->score;
+        }
+        apply_move(w->s, w->scratch, w->s, sol->moves[i]);
+    }
+    return w->s->score;
+}
+
+void accept_candidate(struct optimizer_worker *w, const struct solution *sol, long score) {
+    DEBUG_ASSERT(w && sol);
+    const struct edit *e = &w->edit;
+    struct solution *candidate;
+    long move_count, rest_count;
+    rest_count = sol->move_count - e->at - e->removed_count;
+    move_count = e->at + e->inserted_count + rest_count;
+    if (!(w->candidate = realloc(w->candidate, move_count + 1)))
+        PERROR_EXIT("realloc");
+    memcpy(w->candidate, sol->moves, e->at);
+    memcpy(w->candidate + e->at, e->inserted, e->inserted_count);
+    memcpy(w->candidate + e->at + e->inserted_count, sol->moves + e->at + e->removed_count, rest_count);
+    candidate = build_solution(w->shared, sol, w->candidate, move_count, e->at, w->s, w->scratch);
+    DEBUG_ASSERT(candidate->score == score);
+    install_solution(w->shared, candidate);
+}
+
+void *run_optimizer_worker(void *arg) {
+    struct optimizer_worker *w = arg;
+    struct optimizer *o = w->shared;
+    struct solution *sol;
+    long score;
+    while (get_optimizer_time() < o->deadline) {
+        sol = acquire_solution(o);
+        if (!sol->move_count) {
+            release_solution(o, sol);
+            break;
+        }
+        if (choose_edit(w, sol) && (score = finish_candidate(w, sol)) > sol->score)
+            accept_candidate(w, sol, score);
+        release_solution(o, sol);
+    }
+    return NULL;
+}
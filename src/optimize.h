@@ -0,0 +1,97 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+char *optimize(const struct state *s0, const char *moves, long thread_count, double time_limit, long *out_candidate_count);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+#define OPTIMIZE_MOVES "LRUDWS"
+#define OPTIMIZE_CHECKPOINT_INTERVAL 32
+#define OPTIMIZE_CHECKPOINT_MEMORY (64L << 20)
+#define MAX_LOOP_LENGTH 1024
+#define MAX_SPLICE_LENGTH 64
+#define MAX_CUT_LENGTH 8
+
+#define E_LOOP    0
+#define E_SPLICE  1
+#define E_CUT     2
+#define E_CANCEL  3
+#define E_REPLACE 4
+#define E_SWAP    5
+#define E_ABORT   6
+#define EDIT_KIND_COUNT 7
+
+
+// A solution is never changed once built, so workers can replay from its
+// checkpoints without holding a lock; it is freed when the last one lets go.
+// There is a checkpoint every interval moves, as long as the game goes on,
+// and robot holds the index of the robot after every prefix of the moves.
+struct solution {
+    long reference_count;
+    char *moves;
+    long move_count;
+    long score;
+    char *checkpoint;
+    long checkpoint_count;
+    long *robot;
+};
+
+// Replaces at most removed_count moves from at on with the inserted moves.
+struct edit {
+    long at;
+    long removed_count;
+    char *inserted;
+    long inserted_count;
+};
+
+struct optimizer_worker {
+    pthread_t thread;
+    struct optimizer *shared;
+    unsigned int seed;
+    struct state *s, *scratch;
+    struct edit edit;
+    char *candidate;
+    long *queue;
+    long *visit;
+    long visit_stamp;
+    char *came_by;
+    long candidate_count;
+};
+
+struct optimizer {
+    const struct state *s0;
+    long state_size;
+    long interval;
+    bool is_timeless;
+    double deadline;
+    long thread_count;
+    struct optimizer_worker *worker;
+    pthread_mutex_t best_mutex;
+    struct solution *best;
+};
+
+
+inline struct state *get_checkpoint(const struct optimizer *o, const struct solution *sol, long c) {
+    DEBUG_ASSERT(o && sol && c >= 0 && c < sol->checkpoint_count);
+    return (struct state *)(sol->checkpoint + c * o->state_size);
+}
+
+
+double get_optimizer_time(void);
+
+struct solution *build_solution(struct optimizer *o, const struct solution *old, const char *moves, long move_count, long at, struct state *s, struct state *scratch);
+struct solution *acquire_solution(struct optimizer *o);
+void release_solution(struct optimizer *o, struct solution *sol);
+void install_solution(struct optimizer *o, struct solution *sol);
+
+bool is_same_but_for_time(const struct state *s1, const struct state *s2);
+void replay_to_edit(struct optimizer_worker *w, const struct solution *sol, long at);
+bool find_shortcut(struct optimizer_worker *w, long target, long max_length);
+bool choose_edit(struct optimizer_worker *w, const struct solution *sol);
+long finish_candidate(struct optimizer_worker *w, const struct solution *sol);
+void accept_candidate(struct optimizer_worker *w, const struct solution *sol, long score);
+void *run_optimizer_worker(void *arg);
@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "table.h"
+#include "search.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// Best-first search from s, ordered by the score plus an optimistic estimate
+// of the score still to be made.  Each thread expands nodes from its own queue
+// and steals from the others when it runs dry; states already reached with
+// the same score or better, by any thread, are pruned through a shared table.
+// Nodes that cannot beat the best state found so far, by get_score_bound,
+// are dropped.  Stops after max_node_count expansions, or when the nodes use
+// up SEARCH_MEMORY_LIMIT bytes.  Returns the moves to the best state found, to
+// be freed with free().
+char *search(const struct state *s, long thread_count, long max_node_count, long *out_node_count) {
+    DEBUG_ASSERT(s);
+    struct search sh;
+    struct search_node *root, *n;
+    char *moves;
+    long log_bucket_count, move_count, pruned_count, i;
+    if (thread_count <= 0)
+        thread_count = count_online_cpus();
+    memset(&sh, 0, sizeof(struct search));
+    sh.s0 = s;
+    sh.node_size = (sizeof(struct search_node) + sizeof(struct state) + s->world_length + 15) & ~15L;
+    sh.chunk_size = SEARCH_CHUNK_SIZE > 64 * sh.node_size ? SEARCH_CHUNK_SIZE : 64 * sh.node_size;
+    sh.max_node_count = max_node_count;
+    sh.thread_count = thread_count;
+    for (log_bucket_count = 0; log_bucket_count < MAX_SEARCH_LOG_BUCKET_COUNT && (TABLE_BUCKET_SIZE << log_bucket_count) < 8 * max_node_count; log_bucket_count++)
+        ;
+    sh.table = new_table(log_bucket_count, T_DEPTH_PREFERRED);
+    pthread_mutex_init(&sh.best_mutex, NULL);
+    if (!(sh.worker = calloc(thread_count, sizeof(struct search_worker))))
+        PERROR_EXIT("calloc");
+    for (i = 0; i < thread_count; i++) {
+        sh.worker[i].id = i;
+        sh.worker[i].shared = &sh;
+        pthread_mutex_init(&sh.worker[i].queue.mutex, NULL);
+        if (!(sh.worker[i].scratch = malloc(sizeof(struct state) + s->world_length)))
+            PERROR_EXIT("malloc");
+    }
+    root = new_search_node(&sh.worker[0]);
+    memcpy(root->state, s, sizeof(struct state) + s->world_length);
+    root->parent = NULL;
+    root->move = 0;
+    root->priority = s->score + estimate_score_to_go(s);
+    record_state(sh.table, root->state);
+    sh.best = root;
+    sh.best_score = s->score;
+    if (s->condition == C_NONE)
+        push_search_node(&sh.worker[0].queue, root);
+    sh.active_count = thread_count;
+    for (i = 0; i < thread_count; i++)
+        if (pthread_create(&sh.worker[i].thread, NULL, run_search_worker, &sh.worker[i]))
+            PERROR_EXIT("pthread_create");
+    for (i = 0; i < thread_count; i++)
+        pthread_join(sh.worker[i].thread, NULL);
+    move_count = 0;
+    for (n = sh.best; n->parent; n = n->parent)
+        move_count++;
+    if (!(moves = malloc(move_count + 1)))
+        PERROR_EXIT("malloc");
+    moves[move_count] = 0;
+    for (n = sh.best; n->parent; n = n->parent)
+        moves[--move_count] = n->move;
+    pruned_count = 0;
+    for (i = 0; i < thread_count; i++)
+        pruned_count += sh.worker[i].pruned_count;
+    DEBUG_LOG("search expanded %ld nodes, pruned %ld and found score %ld\n", sh.expanded_count < max_node_count ? sh.expanded_count : max_node_count, pruned_count, sh.best->state->score);
+    if (out_node_count) {
+        *out_node_count = 0;
+        for (i = 0; i < thread_count; i++)
+            *out_node_count += sh.worker[i].expanded_count;
+    }
+    for (i = 0; i < thread_count; i++) {
+        free_search_pool(&sh.worker[i].pool);
+        free(sh.worker[i].queue.node);
+        free(sh.worker[i].scratch);
+        pthread_mutex_destroy(&sh.worker[i].queue.mutex);
+    }
+    free(sh.worker);
+    free(sh.table);
+    pthread_mutex_destroy(&sh.best_mutex);
+    return moves;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// Each chunk starts with a pointer to the one before it.
+struct search_node *new_search_node(struct search_worker *w) {
+    DEBUG_ASSERT(w);
+    struct search *sh = w->shared;
+    struct search_node *n;
+    char *chunk;
+    if (!w->pool.chunk || w->pool.used + sh->node_size > sh->chunk_size) {
+        if (!(chunk = malloc(sh->chunk_size)))
+            PERROR_EXIT("malloc");
+        *(char **)chunk = w->pool.chunk;
+        w->pool.chunk = chunk;
+        w->pool.used = 16;
+        if (__sync_add_and_fetch(&sh->allocated_size, sh->chunk_size) > SEARCH_MEMORY_LIMIT)
+            __atomic_store_n(&sh->stopped, true, __ATOMIC_RELAXED);
+    }
+    n = (struct search_node *)(w->pool.chunk + w->pool.used);
+    n->state = (struct state *)((char *)n + ((sizeof(struct search_node) + 15) & ~15L));
+    w->pool.used += sh->node_size;
+    return n;
+}
+
+// Gives back the node allocated last.
+void release_search_node(struct search_worker *w) {
+    DEBUG_ASSERT(w);
+    w->pool.used -= w->shared->node_size;
+}
+
+void free_search_pool(struct search_pool *p) {
+    DEBUG_ASSERT(p);
+    char *chunk;
+    while ((chunk = p->chunk)) {
+        p->chunk = *(char **)chunk;
+        free(chunk);
+    }
+}
+
+
+// Queues are binary max-heaps on priority.
+void push_search_node(struct search_queue *q, struct search_node *n) {
+    DEBUG_ASSERT(q && n);
+    long i, parent;
+    pthread_mutex_lock(&q->mutex);
+    if (q->node_count == q->capacity) {
+        q->capacity = q->capacity ? 2 * q->capacity : 1024;
+        if (!(q->node = realloc(q->node, q->capacity * sizeof(struct search_node *))))
+            PERROR_EXIT("realloc");
+    }
+    for (i = q->node_count++; i > 0 && q->node[parent = (i - 1) / 2]->priority < n->priority; i = parent)
+        q->node[i] = q->node[parent];
+    q->node[i] = n;
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static struct search_node *pop_locked_search_node(struct search_queue *q) {
+    struct search_node *top, *last;
+    long i, child;
+    if (!q->node_count)
+        return NULL;
+    top = q->node[0];
+    last = q->node[--q->node_count];
+    for (i = 0; (child = 2 * i + 1) < q->node_count; i = child) {
+        if (child + 1 < q->node_count && q->node[child + 1]->priority > q->node[child]->priority)
+            child++;
+        if (q->node[child]->priority <= last->priority)
+            break;
+        q->node[i] = q->node[child];
+    }
+    q->node[i] = last;
+    return top;
+}
+
+struct search_node *pop_search_node(struct search_queue *q) {
+    DEBUG_ASSERT(q);
+    struct search_node *n;
+    pthread_mutex_lock(&q->mutex);
+    n = pop_locked_search_node(q);
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+// Takes up to half of the first non-empty queue found, best nodes first.
+bool steal_search_nodes(struct search_worker *w) {
+    DEBUG_ASSERT(w);
+    struct search *sh = w->shared;
+    struct search_queue *q;
+    struct search_node *stolen[MAX_STEAL_COUNT];
+    long stolen_count, i, k;
+    for (k = 1; k < sh->thread_count; k++) {
+        q = &sh->worker[(w->id + k) % sh->thread_count].queue;
+        pthread_mutex_lock(&q->mutex);
+        for (stolen_count = 0; stolen_count < MAX_STEAL_COUNT && stolen_count < (q->node_count + 1) / 2; stolen_count++)
+            stolen[stolen_count] = pop_locked_search_node(q);
+        pthread_mutex_unlock(&q->mutex);
+        if (!stolen_count)
+            continue;
+        for (i = 0; i < stolen_count; i++)
+            push_search_node(&w->queue, stolen[i]);
+        return true;
+    }
+    return false;
+}
+
+
+// The same as make_one_move, without allocating.
+void apply_move(struct state *s, struct state *scratch, const struct state *s0, char move) {
+    DEBUG_ASSERT(s && scratch && s0);
+    memcpy(scratch, s0, sizeof(struct state) + s0->world_length);
+    if (scratch->condition == C_NONE && is_valid_move(move)) {
+        execute_move(scratch, move);
+        if (scratch->condition == C_NONE) {
+            memcpy(s, scratch, sizeof(struct state) + scratch->world_length);
+            update_world(s, scratch, DO_NOT_IGNORE_ROBOT);
+            return;
+        }
+    }
+    memcpy(s, scratch, sizeof(struct state) + scratch->world_length);
+}
+
+// Admissible, so that nodes which cannot beat the best state found so far
+// can be dropped.
+long estimate_score_to_go(const struct state *s) {
+    DEBUG_ASSERT(s);
+    return get_score_bound(s) - s->score;
+}
+
+void expand_search_node(struct search_worker *w, struct search_node *n) {
+    DEBUG_ASSERT(w && n);
+    struct search *sh = w->shared;
+    struct search_node *child;
+    const char *move;
+    for (move = SEARCH_MOVES; *move; move++) {
+        if (*move == M_SHAVE && !n->state->razor_count)
+            continue;
+        child = new_search_node(w);
+        apply_move(child->state, w->scratch, n->state, *move);
+        if (child->state->condition == C_LOSE || !record_state(sh->table, child->state)) {
+            release_search_node(w);
+            continue;
+        }
+        child->parent = n;
+        child->move = *move;
+        pthread_mutex_lock(&sh->best_mutex);
+        if (child->state->score > sh->best->state->score) {
+            sh->best = child;
+            __atomic_store_n(&sh->best_score, child->state->score, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&sh->best_mutex);
+        if (child->state->condition != C_NONE)
+            continue;
+        child->priority = child->state->score + estimate_score_to_go(child->state);
+        if (child->priority <= __atomic_load_n(&sh->best_score, __ATOMIC_RELAXED)) {
+            if (__atomic_load_n(&sh->best, __ATOMIC_RELAXED) != child)
+                release_search_node(w);
+            w->pruned_count++;
+            continue;
+        }
+        push_search_node(&w->queue, child);
+    }
+}
+
+// A worker that runs dry counts itself out of active_count while it is not
+// holding or stealing work; once the count reaches 0, no node is left
+// anywhere.
+void *run_search_worker(void *arg) {
+    struct search_worker *w = arg;
+    struct search *sh = w->shared;
+    struct search_node *n;
+    while (!__atomic_load_n(&sh->stopped, __ATOMIC_RELAXED)) {
+        if ((n = pop_search_node(&w->queue))) {
+            if (n->priority <= __atomic_load_n(&sh->best_score, __ATOMIC_RELAXED)) {
+                w->pruned_count++;
+                continue;
+            }
+            if (__sync_add_and_fetch(&sh->expanded_count, 1) > sh->max_node_count) {
+                __atomic_store_n(&sh->stopped, true, __ATOMIC_RELAXED);
+                break;
+            }
+            expand_search_node(w, n);
+            w->expanded_count++;
+            continue;
+        }
+        __sync_fetch_and_sub(&sh->active_count, 1);
+        while (true) {
+            if (__atomic_load_n(&sh->stopped, __ATOMIC_RELAXED))
+                return NULL;
+            __sync_fetch_and_add(&sh->active_count, 1);
+            if (steal_search_nodes(w))
+                break;
+            if (!__sync_sub_and_fetch(&sh->active_count, 1))
+                return NULL;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,80 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+char *search(const struct state *s, long thread_count, long max_node_count, long *out_node_count);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+#define SEARCH_MOVES "LRUDWS"
+#define SEARCH_CHUNK_SIZE (4L << 20)
+#define SEARCH_MEMORY_LIMIT (512L << 20)
+#define MAX_SEARCH_LOG_BUCKET_COUNT 20
+#define MAX_STEAL_COUNT 16
+
+
+struct search_node {
+    struct search_node *parent;
+    long priority;
+    char move;
+    struct state *state;
+};
+
+// Nodes are never freed one by one; each worker carves them out of its own
+// chunks, which are all freed when the search ends.
+struct search_pool {
+    char *chunk;
+    long used;
+};
+
+struct search_queue {
+    pthread_mutex_t mutex;
+    struct search_node **node;
+    long node_count;
+    long capacity;
+};
+
+struct search_worker {
+    pthread_t thread;
+    long id;
+    struct search *shared;
+    struct search_queue queue;
+    struct search_pool pool;
+    struct state *scratch;
+    long expanded_count;
+    long pruned_count;
+};
+
+struct search {
+    const struct state *s0;
+    struct table *table;
+    long node_size;
+    long chunk_size;
+    long max_node_count;
+    long thread_count;
+    struct search_worker *worker;
+    long expanded_count;
+    long allocated_size;
+    long active_count;
+    bool stopped;
+    pthread_mutex_t best_mutex;
+    struct search_node *best;
+    long best_score;
+};
+
+
+struct search_node *new_search_node(struct search_worker *w);
+void release_search_node(struct search_worker *w);
+void free_search_pool(struct search_pool *p);
+
+void push_search_node(struct search_queue *q, struct search_node *n);
+struct search_node *pop_search_node(struct search_queue *q);
+bool steal_search_nodes(struct search_worker *w);
+
+void apply_move(struct state *s, struct state *scratch, const struct state *s0, char move);
+long estimate_score_to_go(const struct state *s);
+void expand_search_node(struct search_worker *w, struct search_node *n);
+void *run_search_worker(void *arg);
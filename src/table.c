@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "table.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// The table holds 2^log_bucket_count buckets of TABLE_BUCKET_SIZE entries and
+// is freed with free().  It can be shared between threads without locking.
+struct table *new_table(long log_bucket_count, char policy) {
+    DEBUG_ASSERT(log_bucket_count >= 0 && log_bucket_count < 48);
+    DEBUG_ASSERT(policy == T_ALWAYS_REPLACE || policy == T_DEPTH_PREFERRED);
+    struct table *t;
+    size_t entry_count;
+    entry_count = ((size_t)1 << log_bucket_count) * TABLE_BUCKET_SIZE;
+    if (!(t = malloc(sizeof(struct table) + entry_count * sizeof(unsigned long))))
+        PERROR_EXIT("malloc");
+    t->bucket_mask = ((unsigned long)1 << log_bucket_count) - 1;
+    t->policy = policy;
+    memset(t->entry, 0, entry_count * sizeof(unsigned long));
+    return t;
+}
+
+
+// Finds the best score recorded for the key, if any.
+bool probe_table(const struct table *t, unsigned long key, long *out_score, long *out_move_count) {
+    DEBUG_ASSERT(t && out_score && out_move_count);
+    const unsigned long *bucket;
+    unsigned long entry, best = 0;
+    long i;
+    bucket = t->entry + (key & t->bucket_mask) * TABLE_BUCKET_SIZE;
+    for (i = 0; i < TABLE_BUCKET_SIZE; i++) {
+        entry = __atomic_load_n(&bucket[i], __ATOMIC_ACQUIRE);
+        if (entry && get_entry_tag(entry) == key_to_tag(key) && (!best || get_entry_score(entry) > get_entry_score(best)))
+            best = entry;
+    }
+    if (!best)
+        return false;
+    *out_score = get_entry_score(best);
+    *out_move_count = get_entry_move_count(best);
+    return true;
+}
+
+// Records that the key was reached with the given score.  Returns false when
+// some thread has already reached it with the same score or better, meaning
+// the caller can prune it.
+//
+// A new key goes into the first empty entry of its bucket.  In a full bucket,
+// the entry with the lowest move count is the victim: T_ALWAYS_REPLACE always
+// evicts it, while T_DEPTH_PREFERRED keeps it if it is deeper than the new
+// entry.  Two threads racing to replace different victims with the same key
+// may leave it in the bucket twice, which only costs space.
+bool record_in_table(struct table *t, unsigned long key, long score, long move_count) {
+    DEBUG_ASSERT(t);
+    unsigned long *bucket, entry, new_entry, victim_entry;
+    long i, match, victim;
+    bucket = t->entry + (key & t->bucket_mask) * TABLE_BUCKET_SIZE;
+    new_entry = pack_entry(key, score, move_count);
+    score = get_entry_score(new_entry);
+    while (true) {
+        match = victim = -1;
+        victim_entry = 0;
+        for (i = 0; i < TABLE_BUCKET_SIZE; i++) {
+            entry = __atomic_load_n(&bucket[i], __ATOMIC_ACQUIRE);
+            if (!entry) {
+                if (victim == -1 || victim_entry) {
+                    victim = i;
+                    victim_entry = 0;
+                }
+                break;
+            }
+            if (get_entry_tag(entry) == get_entry_tag(new_entry)) {
+                if (get_entry_score(entry) >= score)
+                    return false;
+                if (match == -1)
+                    match = i;
+            } else if (victim == -1 || get_entry_move_count(entry) < get_entry_move_count(victim_entry)) {
+                victim = i;
+                victim_entry = entry;
+            }
+        }
+        if (match != -1) {
+            entry = __atomic_load_n(&bucket[match], __ATOMIC_ACQUIRE);
+            if (get_entry_tag(entry) != get_entry_tag(new_entry))
+                continue;
+            if (__sync_bool_compare_and_swap(&bucket[match], entry, new_entry))
+                return true;
+            continue;
+        }
+        if (victim == -1)
+            return true;
+        if (victim_entry && t->policy == T_DEPTH_PREFERRED && get_entry_move_count(victim_entry) > get_entry_move_count(new_entry))
+            return true;
+        if (__sync_bool_compare_and_swap(&bucket[victim], victim_entry, new_entry))
+            return true;
+    }
+}
+
+bool record_state(struct table *t, const struct state *s) {
+    DEBUG_ASSERT(t && s);
+    return record_in_table(t, hash(s), s->score, s->move_count);
+}
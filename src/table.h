@@ -0,0 +1,67 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+#define T_ALWAYS_REPLACE   'A'
+#define T_DEPTH_PREFERRED  'D'
+
+
+struct table *new_table(long log_bucket_count, char policy);
+
+bool probe_table(const struct table *t, unsigned long key, long *out_score, long *out_move_count);
+bool record_in_table(struct table *t, unsigned long key, long score, long move_count);
+bool record_state(struct table *t, const struct state *s);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// Each entry packs a tag taken from the top of the key, the score and the
+// move count into one word, so that it can be replaced with a single
+// compare-and-swap.  An entry of 0 is empty; the lowest tag bit is always set.
+#define TABLE_BUCKET_SIZE 4
+#define TABLE_TAG_BITS 24
+#define TABLE_SCORE_BITS 24
+#define TABLE_MOVE_COUNT_BITS 16
+
+#define MIN_TABLE_SCORE (-(1L << (TABLE_SCORE_BITS - 1)))
+#define MAX_TABLE_SCORE ((1L << (TABLE_SCORE_BITS - 1)) - 1)
+#define MAX_TABLE_MOVE_COUNT ((1L << TABLE_MOVE_COUNT_BITS) - 1)
+
+
+struct table {
+    unsigned long bucket_mask;
+    char policy;
+    unsigned long entry[];
+};
+
+
+inline unsigned long key_to_tag(unsigned long key) {
+    return (key >> (sizeof(unsigned long) * CHAR_BIT - TABLE_TAG_BITS)) | 1;
+}
+
+inline unsigned long pack_entry(unsigned long key, long score, long move_count) {
+    if (score < MIN_TABLE_SCORE)
+        score = MIN_TABLE_SCORE;
+    else if (score > MAX_TABLE_SCORE)
+        score = MAX_TABLE_SCORE;
+    if (move_count > MAX_TABLE_MOVE_COUNT)
+        move_count = MAX_TABLE_MOVE_COUNT;
+    return
+        key_to_tag(key) << (TABLE_SCORE_BITS + TABLE_MOVE_COUNT_BITS) |
+        (unsigned long)(score - MIN_TABLE_SCORE) << TABLE_MOVE_COUNT_BITS |
+        (unsigned long)move_count;
+}
+
+inline unsigned long get_entry_tag(unsigned long entry) {
+    return entry >> (TABLE_SCORE_BITS + TABLE_MOVE_COUNT_BITS);
+}
+
+inline long get_entry_score(unsigned long entry) {
+    return (long)((entry >> TABLE_MOVE_COUNT_BITS) & ((1UL << TABLE_SCORE_BITS) - 1)) + MIN_TABLE_SCORE;
+}
+
+inline long get_entry_move_count(unsigned long entry) {
+    return entry & MAX_TABLE_MOVE_COUNT;
+}
@@ -0,0 +1,511 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "tour.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+struct tour *build_tour(const struct state *s, long thread_count) {
+    DEBUG_ASSERT(s);
+    struct tour_matrix tm;
+    struct tour *t;
+    long *seq, seq_length, stop_count, i, j, rounds;
+    bool improved;
+    find_tour_points(s, &tm.point_index, &tm.point_count, &stop_count);
+    tm.unreachable_dist = 4 * s->world_length;
+    build_tour_matrix(s, &tm, thread_count);
+    find_near_points(&tm);
+    if (!(seq = malloc((stop_count + 2) * sizeof(long))))
+        PERROR_EXIT("malloc");
+    seq[0] = 0;
+    seq_length = 1;
+    for (i = 1; i <= stop_count; i++)
+        if (get_tour_matrix_dist(&tm, 0, i) < tm.unreachable_dist)
+            seq[seq_length++] = i;
+    seq[seq_length++] = tm.point_count - 1;
+    order_nearest_neighbour(&tm, seq, seq_length);
+    rounds = 0;
+    do {
+        improved = improve_order_2_opt(&tm, seq, seq_length);
+        improved = improve_order_or_opt(&tm, seq, seq_length) || improved;
+        rounds++;
+    } while (improved && rounds < MAX_TOUR_ROUNDS);
+    if (!(t = malloc(sizeof(struct tour) + 2 * (seq_length - 1) * sizeof(long))))
+        PERROR_EXIT("malloc");
+    t->point_count = 0;
+    t->cost = get_order_cost(&tm, seq, seq_length);
+    for (i = 1; i < seq_length; i++) {
+        j = tm.point_index[seq[i]];
+        if (j < 0)
+            continue;
+        index_to_point(s, j, &t->point_x_y[2 * t->point_count], &t->point_x_y[2 * t->point_count + 1]);
+        t->point_count++;
+    }
+    DEBUG_LOG("tour of %ld points costs %ld after %ld rounds\n", t->point_count, t->cost, rounds);
+    free(seq);
+    free(tm.point_index);
+    free(tm.cell_to_point);
+    free(tm.dist);
+    free(tm.step);
+    free(tm.near);
+    return t;
+}
+
+long get_tour_length(const struct tour *t) {
+    DEBUG_ASSERT(t);
+    return t->point_count;
+}
+
+void get_tour_point(const struct tour *t, long i, long *out_x, long *out_y) {
+    DEBUG_ASSERT(t && i >= 0 && i < t->point_count && out_x && out_y);
+    *out_x = t->point_x_y[2 * i];
+    *out_y = t->point_x_y[2 * i + 1];
+}
+
+long get_tour_cost(const struct tour *t) {
+    DEBUG_ASSERT(t);
+    return t->cost;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// Point 0 is the robot, points 1..stop_count are lambdas (and razors, when
+// the map has beards to shave), and the last point is the lift.  Points are
+// stored as world indices; a missing lift is stored as -1.  Stops the lift
+// can never be reached from are left out.
+void find_tour_points(const struct state *s, long **out_point_index, long *out_point_count, long *out_stop_count) {
+    DEBUG_ASSERT(s && out_point_index && out_point_count && out_stop_count);
+    long *point_index, point_count, beard_count, i;
+    bool has_lift;
+    has_lift = is_valid_point(s->lift_x, s->lift_y);
+    beard_count = 0;
+    point_count = 2;
+    for (i = 0; i < s->world_length; i++) {
+        if (s->world[i] == O_BEARD)
+            beard_count++;
+        else if (s->world[i] == O_LAMBDA || s->world[i] == O_RAZOR)
+            point_count++;
+    }
+    if (!(point_index = malloc(point_count * sizeof(long))))
+        PERROR_EXIT("malloc");
+    point_count = 0;
+    point_index[point_count++] = point_to_index(s, s->robot_x, s->robot_y);
+    for (i = 0; i < s->world_length; i++)
+        if ((s->world[i] == O_LAMBDA || (beard_count && s->world[i] == O_RAZOR)) && !(has_lift && (s->analysis->flags[i] & A_DEAD)))
+            point_index[point_count++] = i;
+    if (has_lift)
+        point_index[point_count++] = point_to_index(s, s->lift_x, s->lift_y);
+    else
+        point_index[point_count++] = -1;
+    *out_point_index = point_index;
+    *out_point_count = point_count;
+    *out_stop_count = point_count - 2;
+}
+
+
+// The static step rules: everything the robot can walk into, dig through or
+// shave is passable, rocks are not, and entering a trampoline lands on its
+// target.  Returns the index reached, or -1.
+long get_static_step(const struct state *s, long i, long offset) {
+    long j, target_i;
+    char object;
+    j = i + offset;
+    if (j < 0 || j >= s->world_length - 1)
+        return -1;
+    object = s->world[j];
+    if (object == O_EMPTY || object == O_EARTH || object == O_LAMBDA || object == O_RAZOR || object == O_BEARD || object == O_ROBOT || object == O_LIFT_OPEN || object == O_LIFT_CLOSED)
+        return j;
+    if (is_valid_trampoline(object)) {
+        target_i = s->trampoline_index_to_target_index[trampoline_to_index(object)];
+        if (!is_valid_point(s->target_x[target_i], s->target_y[target_i]))
+            return -1;
+        return point_to_index(s, s->target_x[target_i], s->target_y[target_i]);
+    }
+    return -1;
+}
+
+// The lift ends a tour, so nothing is reached through it.
+void build_tour_steps(const struct state *s, struct tour_matrix *tm) {
+    DEBUG_ASSERT(s && tm);
+    long offsets[4], i, j;
+    if (!(tm->step = malloc(4 * s->world_length * sizeof(long))))
+        PERROR_EXIT("malloc");
+    offsets[0] = -1;
+    offsets[1] = 1;
+    offsets[2] = -(s->world_w + 1);
+    offsets[3] = s->world_w + 1;
+    for (i = 0; i < s->world_length; i++)
+        for (j = 0; j < 4; j++)
+            tm->step[4 * i + j] = s->world[i] == O_LIFT_CLOSED || s->world[i] == O_LIFT_OPEN ? -1 : get_static_step(s, i, offsets[j]);
+}
+
+// Bit-parallel BFS: up to 64 sources advance together, each cell carrying a
+// mask of the sources that have seen it, of those that reached it in the
+// current level and of those reaching it in the next one.  With a nonzero
+// near_count the search stops once every source has reached that many points.
+void run_multi_source_bfs(const struct state *s, struct tour_matrix *tm, long first_source, long source_count, long near_count) {
+    DEBUG_ASSERT(s && tm && source_count > 0 && source_count <= TOUR_BATCH_SIZE);
+    struct tour_cell *cells;
+    uint64_t bits, near_bits, all_bits;
+    long *frontier, *next_frontier, *swap, found[TOUR_BATCH_SIZE], frontier_length, next_length, dist, i, j, k, b, p;
+    if (!(cells = calloc(s->world_length, sizeof(struct tour_cell))))
+        PERROR_EXIT("calloc");
+    if (!(frontier = malloc(2 * s->world_length * sizeof(long))))
+        PERROR_EXIT("malloc");
+    next_frontier = frontier + s->world_length;
+    frontier_length = 0;
+    for (b = 0; b < source_count; b++) {
+        i = tm->point_index[first_source + b];
+        if (!cells[i].visit)
+            frontier[frontier_length++] = i;
+        cells[i].seen |= (uint64_t)1 << b;
+        cells[i].visit |= (uint64_t)1 << b;
+        tm->dist[(first_source + b) * tm->point_count + first_source + b] = 0;
+        found[b] = 0;
+    }
+    all_bits = source_count == TOUR_BATCH_SIZE ? ~(uint64_t)0 : ((uint64_t)1 << source_count) - 1;
+    near_bits = 0;
+    for (dist = 1; frontier_length && (!near_count || near_bits != all_bits); dist++) {
+        next_length = 0;
+        for (k = 0; k < frontier_length; k++) {
+            const long *step = tm->step + 4 * frontier[k];
+            uint64_t reaching = cells[frontier[k]].visit;
+            cells[frontier[k]].visit = 0;
+            for (j = 0; j < 4; j++) {
+                struct tour_cell *c;
+                uint64_t reached;
+                if ((i = step[j]) == -1)
+                    continue;
+                c = &cells[i];
+                if (!(reached = reaching & ~c->seen))
+                    continue;
+                c->seen |= reached;
+                if (!c->next)
+                    next_frontier[next_length++] = i;
+                c->next |= reached;
+            }
+        }
+        for (k = 0; k < next_length; k++) {
+            i = next_frontier[k];
+            cells[i].visit = cells[i].next;
+            cells[i].next = 0;
+            if ((p = tm->cell_to_point[i]) < 0)
+                continue;
+            for (bits = cells[i].visit; bits; bits &= bits - 1) {
+                b = __builtin_ctzll(bits);
+                tm->dist[(first_source + b) * tm->point_count + p] = dist;
+                if (++found[b] == near_count)
+                    near_bits |= (uint64_t)1 << b;
+            }
+        }
+        swap = frontier;
+        frontier = next_frontier;
+        next_frontier = swap;
+        frontier_length = next_length;
+    }
+    for (b = 0; b < source_count; b++)
+        tm->radius[first_source + b] = frontier_length ? dist - 1 : tm->unreachable_dist;
+    free(cells);
+    free(frontier < next_frontier ? frontier : next_frontier);
+}
+
+// Distances from every point to the lift, searching backwards along the
+// static steps.
+void run_lift_bfs(const struct state *s, struct tour_matrix *tm) {
+    DEBUG_ASSERT(s && tm);
+    long *in_start, *in_cells, *dist, *queue, lift_i, lift_p, head, tail, i, j, p;
+    lift_p = tm->point_count - 1;
+    if ((lift_i = tm->point_index[lift_p]) < 0)
+        return;
+    if (!(in_start = calloc(s->world_length + 1, sizeof(long))))
+        PERROR_EXIT("calloc");
+    if (!(in_cells = malloc(4 * s->world_length * sizeof(long))))
+        PERROR_EXIT("malloc");
+    if (!(dist = malloc(2 * s->world_length * sizeof(long))))
+        PERROR_EXIT("malloc");
+    queue = dist + s->world_length;
+    for (i = 0; i < 4 * s->world_length; i++)
+        if (tm->step[i] != -1)
+            in_start[tm->step[i] + 1]++;
+    for (i = 0; i < s->world_length; i++)
+        in_start[i + 1] += in_start[i];
+    for (i = 0; i < 4 * s->world_length; i++)
+        if (tm->step[i] != -1)
+            in_cells[in_start[tm->step[i]]++] = i / 4;
+    for (i = s->world_length; i > 0; i--)
+        in_start[i] = in_start[i - 1];
+    in_start[0] = 0;
+    for (i = 0; i < s->world_length; i++)
+        dist[i] = -1;
+    dist[lift_i] = 0;
+    head = tail = 0;
+    queue[tail++] = lift_i;
+    while (head < tail) {
+        i = queue[head++];
+        if ((p = tm->cell_to_point[i]) >= 0)
+            tm->dist[p * tm->point_count + lift_p] = dist[i];
+        for (j = in_start[i]; j < in_start[i + 1]; j++) {
+            if (dist[in_cells[j]] != -1)
+                continue;
+            dist[in_cells[j]] = dist[i] + 1;
+            queue[tail++] = in_cells[j];
+        }
+    }
+    free(in_start);
+    free(in_cells);
+    free(dist);
+}
+
+
+struct tour_worker {
+    const struct state *s;
+    struct tour_matrix *tm;
+    long source_count;
+    long next_batch;
+};
+
+static void *run_tour_worker(void *arg) {
+    struct tour_worker *tw = arg;
+    long batch, first_source;
+    while ((batch = __sync_fetch_and_add(&tw->next_batch, 1)) * TOUR_BATCH_SIZE < tw->source_count) {
+        first_source = 1 + batch * TOUR_BATCH_SIZE;
+        run_multi_source_bfs(tw->s, tw->tm, first_source, tw->source_count + 1 - first_source < TOUR_BATCH_SIZE ? tw->source_count + 1 - first_source : TOUR_BATCH_SIZE, TOUR_NEAR_POINT_COUNT);
+    }
+    return NULL;
+}
+
+// Fills the distance matrix.  The robot row and the lift column are exact;
+// every stop searches only until it has reached its nearest points, and pairs
+// beyond that radius get a lower bound instead.  Batches of stops are handed
+// out to the threads as they free up.
+void build_tour_matrix(const struct state *s, struct tour_matrix *tm, long thread_count) {
+    DEBUG_ASSERT(s && tm);
+    struct tour_worker tw;
+    pthread_t *threads;
+    long batch_count, i, j, x1, y1, x2, y2, estimate;
+    if (!(tm->dist = malloc(tm->point_count * (tm->point_count + 1) * sizeof(long))))
+        PERROR_EXIT("malloc");
+    tm->radius = tm->dist + tm->point_count * tm->point_count;
+    if (!(tm->cell_to_point = malloc(s->world_length * sizeof(long))))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < tm->point_count * tm->point_count; i++)
+        tm->dist[i] = tm->unreachable_dist;
+    for (i = 0; i < s->world_length; i++)
+        tm->cell_to_point[i] = -1;
+    for (i = 0; i < tm->point_count; i++)
+        if (tm->point_index[i] >= 0)
+            tm->cell_to_point[tm->point_index[i]] = i;
+    build_tour_steps(s, tm);
+    run_multi_source_bfs(s, tm, 0, 1, 0);
+    run_lift_bfs(s, tm);
+    tw.s = s;
+    tw.tm = tm;
+    tw.source_count = tm->point_count - 2;
+    tw.next_batch = 0;
+    batch_count = (tw.source_count + TOUR_BATCH_SIZE - 1) / TOUR_BATCH_SIZE;
+    if (thread_count <= 0)
+        thread_count = count_online_cpus();
+    if (thread_count > batch_count)
+        thread_count = batch_count;
+    if (thread_count <= 1)
+        run_tour_worker(&tw);
+    else {
+        if (!(threads = malloc(thread_count * sizeof(pthread_t))))
+            PERROR_EXIT("malloc");
+        for (i = 0; i < thread_count; i++)
+            if (pthread_create(&threads[i], NULL, run_tour_worker, &tw))
+                PERROR_EXIT("pthread_create");
+        for (i = 0; i < thread_count; i++)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    }
+    for (i = 1; i + 1 < tm->point_count; i++) {
+        if (tm->radius[i] == tm->unreachable_dist)
+            continue;
+        index_to_point(s, tm->point_index[i], &x1, &y1);
+        for (j = 1; j + 1 < tm->point_count; j++) {
+            if (tm->dist[i * tm->point_count + j] != tm->unreachable_dist)
+                continue;
+            index_to_point(s, tm->point_index[j], &x2, &y2);
+            estimate = labs(x1 - x2) + labs(y1 - y2);
+            tm->dist[i * tm->point_count + j] = estimate > tm->radius[i] ? estimate : tm->radius[i] + 1;
+        }
+    }
+}
+
+
+long get_tour_matrix_dist(const struct tour_matrix *tm, long i, long j) {
+    DEBUG_ASSERT(tm && i >= 0 && i < tm->point_count && j >= 0 && j < tm->point_count);
+    return tm->dist[i * tm->point_count + j];
+}
+
+long get_order_cost(const struct tour_matrix *tm, const long *order, long order_length) {
+    DEBUG_ASSERT(tm && order);
+    long cost, i;
+    cost = 0;
+    for (i = 0; i + 1 < order_length; i++)
+        cost += get_tour_matrix_dist(tm, order[i], order[i + 1]);
+    return cost;
+}
+
+// The first and last entries of an order (robot and lift) stay in place.
+void order_nearest_neighbour(const struct tour_matrix *tm, long *order, long order_length) {
+    DEBUG_ASSERT(tm && order);
+    long best, best_dist, dist, i, j, swap;
+    for (i = 1; i + 2 < order_length; i++) {
+        best = i;
+        best_dist = get_tour_matrix_dist(tm, order[i - 1], order[i]);
+        for (j = i + 1; j + 1 < order_length; j++) {
+            dist = get_tour_matrix_dist(tm, order[i - 1], order[j]);
+            if (dist < best_dist) {
+                best = j;
+                best_dist = dist;
+            }
+        }
+        swap = order[i];
+        order[i] = order[best];
+        order[best] = swap;
+    }
+}
+
+// Candidate moves only ever connect a point to one of its nearest points.
+void find_near_points(struct tour_matrix *tm) {
+    DEBUG_ASSERT(tm);
+    long near_count, dist, i, j, k;
+    near_count = tm->point_count - 1 < MAX_NEAR_POINT_COUNT ? tm->point_count - 1 : MAX_NEAR_POINT_COUNT;
+    if (!(tm->near = malloc(tm->point_count * (near_count + 1) * sizeof(long))))
+        PERROR_EXIT("malloc");
+    tm->near_count = near_count;
+    for (i = 0; i < tm->point_count; i++) {
+        long *near = tm->near + i * (near_count + 1), length = 0;
+        for (j = 0; j < tm->point_count; j++) {
+            if (j == i || (dist = get_tour_matrix_dist(tm, i, j)) >= tm->unreachable_dist)
+                continue;
+            if (length == near_count && dist >= get_tour_matrix_dist(tm, i, near[length - 1]))
+                continue;
+            for (k = length < near_count ? length++ : length - 1; k > 0 && get_tour_matrix_dist(tm, i, near[k - 1]) > dist; k--)
+                near[k] = near[k - 1];
+            near[k] = j;
+        }
+        near[length] = -1;
+    }
+}
+
+static void update_order_sums(const struct tour_matrix *tm, const long *order, long order_length, long *forward, long *backward, long *position) {
+    long i;
+    forward[0] = backward[0] = 0;
+    position[order[0]] = 0;
+    for (i = 1; i < order_length; i++) {
+        forward[i] = forward[i - 1] + get_tour_matrix_dist(tm, order[i - 1], order[i]);
+        backward[i] = backward[i - 1] + get_tour_matrix_dist(tm, order[i], order[i - 1]);
+        position[order[i]] = i;
+    }
+}
+
+// Reversing order[i..j] replaces the edge into order[i] by one into order[j].
+// Trampolines make the matrix asymmetric, so the reversed segment is costed
+// from prefix sums taken in both directions along the order.
+bool improve_order_2_opt(const struct tour_matrix *tm, long *order, long order_length) {
+    DEBUG_ASSERT(tm && order);
+    long *forward, *backward, *position, *near, delta, i, j, k, swap, a, b;
+    bool improved, any_improved;
+    if (order_length < 4)
+        return false;
+    if (!(forward = malloc((2 * order_length + tm->point_count) * sizeof(long))))
+        PERROR_EXIT("malloc");
+    backward = forward + order_length;
+    position = backward + order_length;
+    for (i = 0; i < tm->point_count; i++)
+        position[i] = -1;
+    update_order_sums(tm, order, order_length, forward, backward, position);
+    any_improved = false;
+    do {
+        improved = false;
+        for (i = 1; i + 2 < order_length; i++) {
+            near = tm->near + order[i - 1] * (tm->near_count + 1);
+            for (k = 0; near[k] != -1; k++) {
+                j = position[near[k]];
+                if (j <= i || j + 1 >= order_length)
+                    continue;
+                delta =
+                    get_tour_matrix_dist(tm, order[i - 1], order[j]) + (backward[j] - backward[i]) + get_tour_matrix_dist(tm, order[i], order[j + 1]) -
+                    get_tour_matrix_dist(tm, order[i - 1], order[i]) - (forward[j] - forward[i]) - get_tour_matrix_dist(tm, order[j], order[j + 1]);
+                if (delta < 0) {
+                    for (a = i, b = j; a < b; a++, b--) {
+                        swap = order[a];
+                        order[a] = order[b];
+                        order[b] = swap;
+                    }
+                    update_order_sums(tm, order, order_length, forward, backward, position);
+                    improved = any_improved = true;
+                    near = tm->near + order[i - 1] * (tm->near_count + 1);
+                }
+            }
+        }
+    } while (improved);
+    free(forward);
+    return any_improved;
+}
+
+// Moves a segment of up to three stops, unreversed, to follow one of the
+// points nearest to its first stop.
+bool improve_order_or_opt(const struct tour_matrix *tm, long *order, long order_length) {
+    DEBUG_ASSERT(tm && order);
+    long *position, *near, segment[3], length, delta, i, j, k, m;
+    bool improved, any_improved;
+    if (!(position = malloc(tm->point_count * sizeof(long))))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < tm->point_count; i++)
+        position[i] = -1;
+    for (i = 0; i < order_length; i++)
+        position[order[i]] = i;
+    any_improved = false;
+    do {
+        improved = false;
+        for (length = 1; length <= 3; length++) {
+            for (i = 1; i + length < order_length; i++) {
+                long first = order[i], last = order[i + length - 1], before = order[i - 1], after = order[i + length];
+                long removal = get_tour_matrix_dist(tm, before, after) - get_tour_matrix_dist(tm, before, first) - get_tour_matrix_dist(tm, last, after);
+                near = tm->near + first * (tm->near_count + 1);
+                for (m = 0; near[m] != -1; m++) {
+                    j = position[near[m]];
+                    if (j < 0 || j + 1 >= order_length || (j >= i - 1 && j < i + length))
+                        continue;
+                    delta = removal + get_tour_matrix_dist(tm, order[j], first) + get_tour_matrix_dist(tm, last, order[j + 1]) - get_tour_matrix_dist(tm, order[j], order[j + 1]);
+                    if (delta >= 0)
+                        continue;
+                    memcpy(segment, order + i, length * sizeof(long));
+                    if (j < i) {
+                        memmove(order + j + 1 + length, order + j + 1, (i - j - 1) * sizeof(long));
+                        k = j + 1;
+                    } else {
+                        memmove(order + i, order + i + length, (j + 1 - i - length) * sizeof(long));
+                        k = j + 1 - length;
+                    }
+                    memcpy(order + k, segment, length * sizeof(long));
+                    for (k = 0; k < order_length; k++)
+                        position[order[k]] = k;
+                    improved = any_improved = true;
+                    break;
+                }
+            }
+        }
+    } while (improved);
+    free(position);
+    return any_improved;
+}
@@ -0,0 +1,59 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+struct tour *build_tour(const struct state *s, long thread_count);
+
+long get_tour_length(const struct tour *t);
+void get_tour_point(const struct tour *t, long i, long *out_x, long *out_y);
+long get_tour_cost(const struct tour *t);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+// Sources are searched 64 at a time, one bit per source in each cell's mask.
+#define TOUR_BATCH_SIZE 64
+
+#define MAX_TOUR_ROUNDS 64
+#define TOUR_NEAR_POINT_COUNT 8
+#define MAX_NEAR_POINT_COUNT 16
+
+
+struct tour {
+    long point_count;
+    long cost;
+    long point_x_y[];
+};
+
+struct tour_cell {
+    uint64_t seen, visit, next;
+};
+
+struct tour_matrix {
+    long point_count;
+    long unreachable_dist;
+    long *point_index;
+    long *cell_to_point;
+    long *step;
+    long *dist;
+    long *radius;
+    long near_count;
+    long *near;
+};
+
+
+void find_tour_points(const struct state *s, long **out_point_index, long *out_point_count, long *out_stop_count);
+long get_static_step(const struct state *s, long i, long offset);
+void build_tour_steps(const struct state *s, struct tour_matrix *tm);
+void run_multi_source_bfs(const struct state *s, struct tour_matrix *tm, long first_source, long source_count, long near_count);
+void run_lift_bfs(const struct state *s, struct tour_matrix *tm);
+void build_tour_matrix(const struct state *s, struct tour_matrix *tm, long thread_count);
+
+long get_tour_matrix_dist(const struct tour_matrix *tm, long i, long j);
+long get_order_cost(const struct tour_matrix *tm, const long *order, long order_length);
+void find_near_points(struct tour_matrix *tm);
+void order_nearest_neighbour(const struct tour_matrix *tm, long *order, long order_length);
+bool improve_order_2_opt(const struct tour_matrix *tm, long *order, long order_length);
+bool improve_order_or_opt(const struct tour_matrix *tm, long *order, long order_length);
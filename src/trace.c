@@ -0,0 +1,232 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libvm.h"
+#include "trace.h"
+
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// Records the initial state and the state after each move, until a move
+// leaves the state unchanged.
+void write_trace(const char *path, const struct state *s0, const char *moves) {
+    DEBUG_ASSERT(path && s0 && moves);
+    struct trace_writer w;
+    struct trace_header header;
+    struct trace_footer footer;
+    struct state *s, *s1;
+    long i;
+    memset(&w, 0, sizeof(w));
+    if (!(w.f = fopen(path, "wb")))
+        PERROR_EXIT(path);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.state_size = sizeof(struct state);
+    header.world_length = s0->world_length;
+    header.keyframe_interval = TRACE_KEYFRAME_INTERVAL;
+    write_trace_bytes(&w, &header, sizeof(header));
+    s = copy(s0);
+    write_keyframe(&w, s);
+    for (i = 0; moves[i]; i++) {
+        s1 = make_one_move(s, moves[i]);
+        if (equal(s1, s)) {
+            free(s1);
+            break;
+        }
+        if (w.state_count % TRACE_KEYFRAME_INTERVAL)
+            write_delta(&w, s, s1);
+        else
+            write_keyframe(&w, s1);
+        free(s);
+        s = s1;
+    }
+    free(s);
+    footer.index_offset = w.offset;
+    footer.keyframe_count = w.keyframe_count;
+    footer.state_count = w.state_count;
+    memcpy(footer.magic, TRACE_MAGIC, sizeof(footer.magic));
+    write_trace_bytes(&w, w.keyframe_offset, sizeof(long) * w.keyframe_count);
+    write_trace_bytes(&w, &footer, sizeof(footer));
+    if (fclose(w.f))
+        PERROR_EXIT("fclose");
+    free(w.keyframe_offset);
+    free(w.cell);
+}
+
+struct trace *open_trace(const char *path) {
+    DEBUG_ASSERT(path);
+    struct trace *t;
+    struct stat info;
+    int fd;
+    if (!(t = malloc(sizeof(struct trace))))
+        PERROR_EXIT("malloc");
+    if ((fd = open(path, O_RDONLY)) == -1)
+        PERROR_EXIT(path);
+    if (fstat(fd, &info) == -1)
+        PERROR_EXIT("fstat");
+    t->length = info.st_size;
+    if (t->length < (long)(sizeof(struct trace_header) + sizeof(struct trace_footer)))
+        LOG_EXIT("%s: not a trace\n", path);
+    if ((t->data = mmap(0, t->length, PROT_READ, MAP_SHARED, fd, 0)) == (char *)-1)
+        PERROR_EXIT("mmap");
+    close(fd);
+    memcpy(&t->header, t->data, sizeof(t->header));
+    memcpy(&t->footer, t->data + t->length - sizeof(t->footer), sizeof(t->footer));
+    if (memcmp(t->header.magic, TRACE_MAGIC, sizeof(t->header.magic)) || memcmp(t->footer.magic, TRACE_MAGIC, sizeof(t->footer.magic)))
+        LOG_EXIT("%s: not a trace\n", path);
+    if (t->header.version != TRACE_VERSION || t->header.state_size != sizeof(struct state))
+        LOG_EXIT("%s: trace is from another version of libvm\n", path);
+    t->keyframe_offset = (const long *)(t->data + t->footer.index_offset);
+    return t;
+}
+
+long get_trace_length(const struct trace *t) {
+    DEBUG_ASSERT(t);
+    return t->footer.state_count;
+}
+
+// The state after the first n moves, rebuilt from the keyframe before it.
+// It has no analysis, so it can be dumped but not moved.
+struct state *read_trace_state(const struct trace *t, long n) {
+    DEBUG_ASSERT(t && n >= 0 && n < t->footer.state_count);
+    struct state *s;
+    const char *p;
+    long i;
+    if (!(s = malloc(sizeof(struct state) + t->header.world_length)))
+        PERROR_EXIT("malloc");
+    i = n / t->header.keyframe_interval;
+    p = read_keyframe(t, t->data + t->keyframe_offset[i], s);
+    for (i *= t->header.keyframe_interval; i < n; i++)
+        p = read_delta(t, p, s);
+    return s;
+}
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+void write_trace_bytes(struct trace_writer *w, const void *bytes, long length) {
+    DEBUG_ASSERT(w && bytes);
+    if (length && fwrite(bytes, 1, length, w->f) != (size_t)length)
+        PERROR_EXIT("fwrite");
+    w->offset += length;
+}
+
+// Seven bits at a time, lowest first, with the top bit set on all but the last.
+void write_trace_number(struct trace_writer *w, unsigned long number) {
+    DEBUG_ASSERT(w);
+    unsigned char byte[10];
+    long length = 0;
+    do {
+        byte[length++] = (number & 0x7f) | (number > 0x7f ? 0x80 : 0);
+        number >>= 7;
+    } while (number);
+    write_trace_bytes(w, byte, length);
+}
+
+void write_keyframe(struct trace_writer *w, const struct state *s) {
+    DEBUG_ASSERT(w && s);
+    const char type = R_KEYFRAME;
+    if (!(w->keyframe_offset = realloc(w->keyframe_offset, sizeof(long) * (w->keyframe_count + 1))))
+        PERROR_EXIT("realloc");
+    w->keyframe_offset[w->keyframe_count++] = w->offset;
+    write_trace_bytes(w, &type, 1);
+    write_trace_bytes(w, (const char *)s + TRACE_FIELD_OFFSET, sizeof(struct state) - TRACE_FIELD_OFFSET + s->world_length);
+    w->state_count++;
+}
+
+// Field values are zigzag encoded, as the score may be negative.  Cells are
+// compared a block at a time, as few change on most moves.
+void write_delta(struct trace_writer *w, const struct state *s0, const struct state *s) {
+    DEBUG_ASSERT(w && s0 && s && s0->world_length == s->world_length);
+    const char type = R_DELTA;
+    long field_count = 0, cell_count = 0, last_i = 0, field, i, j, k;
+    for (i = 0; i < (long)TRACE_FIELD_COUNT; i++)
+        field_count += get_trace_field(s0, i) != get_trace_field(s, i);
+    for (i = 0; i < s->world_length; i = j) {
+        j = i + TRACE_BLOCK_SIZE < s->world_length ? i + TRACE_BLOCK_SIZE : s->world_length;
+        if (!memcmp(s0->world + i, s->world + i, j - i))
+            continue;
+        for (k = i; k < j; k++) {
+            if (s0->world[k] == s->world[k])
+                continue;
+            if (cell_count == w->cell_capacity) {
+                w->cell_capacity = 2 * w->cell_capacity + 64;
+                if (!(w->cell = realloc(w->cell, sizeof(long) * w->cell_capacity)))
+                    PERROR_EXIT("realloc");
+            }
+            w->cell[cell_count++] = k;
+        }
+    }
+    write_trace_bytes(w, &type, 1);
+    write_trace_number(w, field_count);
+    for (i = 0; i < (long)TRACE_FIELD_COUNT; i++) {
+        if ((field = get_trace_field(s, i)) == get_trace_field(s0, i))
+            continue;
+        write_trace_number(w, i);
+        write_trace_number(w, ((unsigned long)field << 1) ^ (unsigned long)(field >> (sizeof(long) * CHAR_BIT - 1)));
+    }
+    write_trace_number(w, cell_count);
+    for (j = 0; j < cell_count; j++) {
+        write_trace_number(w, w->cell[j] - last_i);
+        write_trace_bytes(w, &s->world[w->cell[j]], 1);
+        last_i = w->cell[j];
+    }
+    w->state_count++;
+}
+
+
+unsigned long read_trace_number(const char **p) {
+    DEBUG_ASSERT(p && *p);
+    unsigned long number = 0;
+    unsigned char byte;
+    long shift = 0;
+    do {
+        byte = *(*p)++;
+        number |= (unsigned long)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return number;
+}
+
+const char *read_keyframe(const struct trace *t, const char *p, struct state *s) {
+    DEBUG_ASSERT(t && p && s && *p == R_KEYFRAME);
+    p++;
+    s->analysis = NULL;
+    memcpy((char *)s + TRACE_FIELD_OFFSET, p, sizeof(struct state) - TRACE_FIELD_OFFSET + t->header.world_length);
+    return p + sizeof(struct state) - TRACE_FIELD_OFFSET + t->header.world_length;
+}
+
+const char *read_delta(const struct trace *t, const char *p, struct state *s) {
+    DEBUG_ASSERT(t && p && s && *p == R_DELTA);
+    unsigned long field;
+    long count, i, j;
+    p++;
+    count = read_trace_number(&p);
+    while (count--) {
+        i = read_trace_number(&p);
+        field = read_trace_number(&p);
+        put_trace_field(s, i, (long)(field >> 1) ^ -(long)(field & 1));
+    }
+    count = read_trace_number(&p);
+    for (j = 0; count--; ) {
+        j += read_trace_number(&p);
+        s->world[j] = *p++;
+    }
+    return p;
+}
@@ -0,0 +1,86 @@
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+void write_trace(const char *path, const struct state *s0, const char *moves);
+
+struct trace *open_trace(const char *path);
+long get_trace_length(const struct trace *t);
+struct state *read_trace_state(const struct trace *t, long n);
+
+
+// ---------------------------------------------------------------------------
+// Private
+// ---------------------------------------------------------------------------
+
+#define TRACE_MAGIC "\177LTRACE"
+#define TRACE_VERSION 1
+#define TRACE_KEYFRAME_INTERVAL 64
+#define TRACE_BLOCK_SIZE 256
+
+#define R_KEYFRAME 'K'
+#define R_DELTA    'D'
+
+
+// A trace holds one record for every state along the moves, the first being
+// the initial state: in full for every TRACE_KEYFRAME_INTERVAL-th state, as
+// the words of struct state that changed and the changed cells otherwise.
+// Numbers in a delta are variable length, cell indices as gaps from the one
+// before.  An index of keyframe offsets and a footer come last.
+struct trace_header {
+    char magic[8];
+    long version;
+    long state_size;
+    long world_length;
+    long keyframe_interval;
+};
+
+struct trace_footer {
+    long index_offset;
+    long keyframe_count;
+    long state_count;
+    char magic[8];
+};
+
+struct trace {
+    const char *data;
+    long length;
+    struct trace_header header;
+    struct trace_footer footer;
+    const long *keyframe_offset;
+};
+
+struct trace_writer {
+    FILE *f;
+    long offset;
+    long state_count;
+    long *keyframe_offset;
+    long keyframe_count;
+    long *cell;
+    long cell_capacity;
+};
+
+
+// Fields of struct state from world_w to the world, copied word by word.
+#define TRACE_FIELD_OFFSET offsetof(struct state, world_w)
+#define TRACE_FIELD_COUNT ((offsetof(struct state, world) - TRACE_FIELD_OFFSET) / sizeof(long))
+
+inline long get_trace_field(const struct state *s, long i) {
+    long field;
+    memcpy(&field, (const char *)s + TRACE_FIELD_OFFSET + i * sizeof(long), sizeof(long));
+    return field;
+}
+
+inline void put_trace_field(struct state *s, long i, long field) {
+    memcpy((char *)s + TRACE_FIELD_OFFSET + i * sizeof(long), &field, sizeof(long));
+}
+
+
+void write_trace_bytes(struct trace_writer *w, const void *bytes, long length);
+void write_trace_number(struct trace_writer *w, unsigned long number);
+void write_keyframe(struct trace_writer *w, const struct state *s);
+void write_delta(struct trace_writer *w, const struct state *s0, const struct state *s);
+
+unsigned long read_trace_number(const char **p);
+const char *read_keyframe(const struct trace *t, const char *p, struct state *s);
+const char *read_delta(const struct trace *t, const char *p, struct state *s);
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libvm.h"
+#include "batch.h"
+
+
+#define DEFAULT_STATE_COUNT 256
+#define DEFAULT_MOVE_COUNT 1000
+#define TEST_MOVES "LRUDWS"
+
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+// Returns the number of states that differ at the end.
+long test_map(const char *path, long state_count, long move_count) {
+    struct state *s0, **s, *s1;
+    struct batch *b;
+    char *moves;
+    long failure_count = 0, i, k;
+    double start, batch_time = 0, loop_time = 0;
+    s0 = new_from_file(path);
+    if (!(s = malloc(state_count * sizeof(struct state *))) || !(moves = malloc(move_count * state_count)))
+        PERROR_EXIT("malloc");
+    for (k = 0; k < state_count; k++)
+        s[k] = copy(s0);
+    for (i = 0; i < move_count * state_count; i++)
+        moves[i] = TEST_MOVES[rand() % (sizeof(TEST_MOVES) - 1)];
+    b = new_batch((const struct state *const *)s, state_count);
+    start = get_time();
+    for (i = 0; i < move_count; i++)
+        step_batch(b, moves + i * state_count);
+    batch_time = get_time() - start;
+    start = get_time();
+    for (i = 0; i < move_count; i++) {
+        for (k = 0; k < state_count; k++) {
+            s1 = make_one_move(s[k], moves[i * state_count + k]);
+            free(s[k]);
+            s[k] = s1;
+        }
+    }
+    loop_time = get_time() - start;
+    for (k = 0; k < state_count; k++) {
+        s1 = get_batch_state(b, k);
+        if (!equal(s1, s[k])) {
+            if (!failure_count)
+                LOG("%s: state %ld differs\n", path, k);
+            failure_count++;
+        }
+        free(s1);
+        free(s[k]);
+    }
+    printf("%-28s  batch %10.0f steps/s  loop %10.0f steps/s  speedup %5.2f\n", path, move_count * state_count / batch_time, move_count * state_count / loop_time, loop_time / batch_time);
+    free(b);
+    free(moves);
+    free(s);
+    free(s0);
+    return failure_count;
+}
+
+
+int main(int argc, char **argv) {
+    long state_count = DEFAULT_STATE_COUNT, move_count = DEFAULT_MOVE_COUNT, failure_count = 0, i;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            state_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            move_count = atol(argv[++i]);
+    }
+    if (state_count < 1 || move_count < 1)
+        LOG_EXIT("usage: %s <map>... [-n <state-count>] [-m <move-count>]\n", argv[0]);
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "-m"))
+            i++;
+        else
+            failure_count += test_map(argv[i], state_count, move_count);
+    }
+    return failure_count ? 1 : 0;
+}
@@ -0,0 +1,561 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdint.h>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A header-only engine for the full rules, written to agree with src/libvm.c
+// move for move, quirks included.  Engine is parameterised on where its cells
+// live and on which rules it enforces; a disabled rule costs nothing, since
+// every test on it is a constant.  Once loaded, an engine never allocates:
+// moves are replayed in place and copies reuse the destination's storage.
+namespace engine {
+
+typedef char Object;
+typedef char Move;
+typedef char Condition;
+
+constexpr Object Robot = 'R';
+constexpr Object Wall = '#';
+constexpr Object Rock = '*';
+constexpr Object Lambda = '\\';
+constexpr Object ClosedLift = 'L';
+constexpr Object OpenLift = 'O';
+constexpr Object Earth = '.';
+constexpr Object Empty = ' ';
+constexpr Object Beard = 'W';
+constexpr Object Razor = '!';
+constexpr Object HoRock = '@';
+constexpr Object FirstTrampoline = 'A';
+constexpr Object LastTrampoline = 'I';
+constexpr Object FirstTarget = '1';
+constexpr Object LastTarget = '9';
+
+constexpr Move MoveLeft = 'L';
+constexpr Move MoveRight = 'R';
+constexpr Move MoveUp = 'U';
+constexpr Move MoveDown = 'D';
+constexpr Move MoveWait = 'W';
+constexpr Move MoveAbort = 'A';
+constexpr Move MoveShave = 'S';
+
+constexpr Condition None = 'N';
+constexpr Condition Win = 'W';
+constexpr Condition Lose = 'L';
+constexpr Condition Aborted = 'A';
+
+constexpr int MaxTrampolineCount = 9;
+
+enum Rules : unsigned {
+  BaseRules = 0,
+  WaterRules = 1,
+  BeardRules = 2,
+  TrampolineRules = 4,
+  HoRockRules = 8,
+  FullRules = WaterRules | BeardRules | TrampolineRules | HoRockRules
+};
+
+constexpr bool isMove(Move m) {
+  return m == MoveLeft || m == MoveRight || m == MoveUp || m == MoveDown ||
+    m == MoveWait || m == MoveAbort || m == MoveShave;
+}
+constexpr bool isStep(Move m) {
+  return m == MoveLeft || m == MoveRight || m == MoveUp || m == MoveDown;
+}
+constexpr bool isTrampoline(Object o) {
+  return o >= FirstTrampoline && o <= LastTrampoline;
+}
+constexpr bool isTarget(Object o) {
+  return o >= FirstTarget && o <= LastTarget;
+}
+constexpr bool isRock(Object o, unsigned rules = FullRules) {
+  return o == Rock || ((rules & HoRockRules) && o == HoRock);
+}
+constexpr bool isLambdaSource(Object o, unsigned rules = FullRules) {
+  return o == Lambda || ((rules & HoRockRules) && o == HoRock);
+}
+
+// Whether any of the 8 bytes in the word equals o.
+inline bool hasObject(uint64_t word, Object o) {
+  word ^= 0x0101010101010101ULL * (unsigned char) o;
+  return (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+}
+
+// Keeps up to Capacity cells inline, so that neither loading nor copying an
+// engine touches the heap.  Copies only copy the cells in use.
+template <int Capacity>
+class FixedCells {
+public:
+  FixedCells() : _size(0) {}
+  FixedCells(const FixedCells &other) : _size(other._size) {
+    std::copy(other._cells, other._cells + _size, _cells);
+  }
+  FixedCells &operator=(const FixedCells &other) {
+    _size = other._size;
+    std::copy(other._cells, other._cells + _size, _cells);
+    return *this;
+  }
+
+  Object *resize(int size) {
+    if (size > Capacity)
+      throw std::length_error("map too large for FixedCells");
+    _size = size;
+    return _cells;
+  }
+  Object *data() { return _cells; }
+  const Object *data() const { return _cells; }
+
+private:
+  int _size;
+  Object _cells[Capacity];
+};
+
+// Sized to the map when it is loaded.
+class VectorCells {
+public:
+  Object *resize(int size) {
+    _cells.resize(size);
+    return data();
+  }
+  Object *data() { return _cells.empty() ? 0 : &_cells[0]; }
+  const Object *data() const { return _cells.empty() ? 0 : &_cells[0]; }
+
+private:
+  std::vector<Object> _cells;
+};
+
+// The world is kept in two generations of _stride * (_height + 2) cells,
+// surrounded by walls so that no rule needs a bounds check.  Row y holds the
+// cells with that y, so the bottom row comes first and a pass over memory
+// visits cells in the order update_world() does.  Cells are referred to by
+// index, both generations being addressed relative to the current one, so
+// that copying an engine copies no pointers.
+template <class Storage = VectorCells, unsigned RuleSet = FullRules>
+class Engine {
+public:
+  Engine() { clear(); }
+
+  void load(const char *input, long length);
+  void load(const std::string &input) { load(input.data(), input.size()); }
+
+  // Like make_one_move(): anything but a valid move is ignored.
+  void step(Move m) {
+    if (_condition != None || !isMove(m))
+      return;
+    execute(m);
+    if (_condition == None)
+      update();
+  }
+
+  // Like make_moves(): stops at the first invalid move.  Returns the first
+  // move not made.
+  const char *replay(const char *moves) {
+    while (_condition == None && isMove(*moves)) {
+      execute(*moves);
+      if (_condition == None)
+        update();
+      moves++;
+    }
+    return moves;
+  }
+
+  int width() const { return _width; }
+  int height() const { return _height; }
+  int robotX() const { return indexToX(_robot); }
+  int robotY() const { return _robotY; }
+  int waterLevel() const { return _waterLevel; }
+  int usedWaterproofing() const { return _usedWaterproofing; }
+  int razorCount() const { return _razorCount; }
+  int lambdaCount() const { return _lambdaCount; }
+  int collectedCount() const { return _collectedCount; }
+  int trampolineCount() const { return _trampolineCount; }
+  int moveCount() const { return _moveCount; }
+  int score() const { return _score; }
+  Condition condition() const { return _condition; }
+
+  Object get(int x, int y) const {
+    if (x < 1 || y < 1 || x > _width || y > _height)
+      return Wall;
+    return cells()[index(x, y)];
+  }
+
+  // Writes the world as libvm lays it out: rows from the top, each ending in
+  // a newline.  out must hold (width() + 1) * height() characters.
+  void writeWorld(char *out) const {
+    const Object *c = cells();
+    for (int r = _height; r >= 1; r--) {
+      out = std::copy(c + r * _stride + 1, c + r * _stride + 1 + _width, out);
+      *out++ = '\n';
+    }
+  }
+
+private:
+  int index(int x, int y) const { return y * _stride + x; }
+  int indexToX(int i) const { return i % _stride; }
+  int indexToY(int i) const { return i / _stride; }
+
+  Object *cells() { return _storage.data() + _current; }
+  const Object *cells() const { return _storage.data() + _current; }
+  Object *nextCells() { return _storage.data() + (_size - _current); }
+
+  void clear();
+  void execute(Move m);
+  void moveRobot(int to);
+  void teleportRobot(int to);
+  void clearSimilarTrampolines(Object trampoline);
+  void shaveBeard();
+  void update();
+  void updateCell(const Object *c, Object *n, int i, bool grow, bool open);
+
+  // Most cells never change by themselves, so update() skips runs of 8 cells
+  // holding none of the objects that do.
+  static bool mayChange(Object o, bool grow, bool open) {
+    return isRock(o, RuleSet) || (grow && o == Beard) || (open && o == ClosedLift);
+  }
+  static bool mayChange(const Object *c, bool grow, bool open) {
+    uint64_t word;
+    std::memcpy(&word, c, sizeof(word));
+    return hasObject(word, Rock) || ((RuleSet & HoRockRules) && hasObject(word, HoRock)) ||
+      (grow && hasObject(word, Beard)) || (open && hasObject(word, ClosedLift));
+  }
+  void dropRock(const Object *c, Object *n, Object rock, int at);
+
+  Storage _storage;
+  int _width, _height, _stride, _size, _current;
+  int _robot, _robotY, _lift;
+  int _waterLevel, _floodingRate, _waterproofing, _usedWaterproofing;
+  int _growthRate, _razorCount;
+  bool _bearded;
+  int _lambdaCount, _collectedCount;
+  int _trampolineCount;
+  int _trampoline[MaxTrampolineCount + 1], _target[MaxTrampolineCount + 1];
+  int _trampolineTarget[MaxTrampolineCount + 1];
+  int _moveCount, _score;
+  Condition _condition;
+};
+
+template <class Storage, unsigned RuleSet>
+std::ostream &operator<<(std::ostream &stream, const Engine<Storage, RuleSet> &e)
+{
+  std::vector<char> world((e.width() + 1) * e.height());
+  e.writeWorld(world.data());
+  stream << e.score() << '\n';
+  return stream.write(world.data(), world.size());
+}
+
+
+// Parses a map the way the loader in libvm does: the world ends at the first
+// empty line, short rows are padded with empty cells, and metadata is a
+// stream of key and value tokens.
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::load(const char *input, long length)
+{
+  clear();
+  long i, w = 0;
+  for (i = 0; i < length; i++) {
+    if (input[i] != '\n')
+      w++;
+    if (i == length - 1 || input[i] == '\n') {
+      if (w == 0)
+        break;
+      _width = std::max<int>(_width, w);
+      _height++;
+      w = 0;
+    }
+  }
+  _stride = _width + 2;
+  _size = _stride * (_height + 2);
+  Object *c = _storage.resize(2 * _size);
+  std::fill(c, c + 2 * _size, Wall);
+
+  int x = 1, y = _height;
+  for (i = 0; i < length; i++) {
+    if (input[i] != '\n') {
+      Object o = input[i];
+      int at = index(x, y);
+      if (o == Robot) {
+        _robot = at;
+        _robotY = y;
+      } else if (o == Beard) {
+        _bearded = true;
+      } else if (isLambdaSource(o, RuleSet)) {
+        _lambdaCount++;
+      } else if (o == ClosedLift) {
+        _lift = at;
+      } else if (isTrampoline(o)) {
+        _trampoline[o - FirstTrampoline + 1] = at;
+      } else if (isTarget(o)) {
+        _target[o - FirstTarget + 1] = at;
+      }
+      c[at] = o;
+      x++;
+    }
+    if (i == length - 1 || input[i] == '\n') {
+      if (x == 1)
+        break;
+      for (; x <= _width; x++)
+        c[index(x, y)] = Empty;
+      y--;
+      x = 1;
+    }
+  }
+  std::copy(c, c + _size, c + _size);
+
+  enum {
+    NoKey, WaterKey, FloodingKey, WaterproofKey, GrowthKey, RazorsKey,
+    TrampolineKey, TrampolineTargetKey, TargetKey, InvalidKey
+  } key = NoKey;
+  int trampoline = 0;
+  std::string token;
+  for (i++; i < length; i++) {
+    if (input[i] != ' ' && input[i] != '\n')
+      token += input[i];
+    if (i < length - 1 && input[i] != ' ' && input[i] != '\n')
+      continue;
+    if (token.empty())
+      continue;
+    int value = std::atoi(token.c_str());
+    switch (key) {
+    case NoKey:
+      if (token == "Water")
+        key = WaterKey;
+      else if (token == "Flooding")
+        key = FloodingKey;
+      else if (token == "Waterproof")
+        key = WaterproofKey;
+      else if (token == "Trampoline")
+        key = TrampolineKey;
+      else if (token == "Growth")
+        key = GrowthKey;
+      else if (token == "Razors")
+        key = RazorsKey;
+      else
+        key = InvalidKey;
+      break;
+    case WaterKey: _waterLevel = value; key = NoKey; break;
+    case FloodingKey: _floodingRate = value; key = NoKey; break;
+    case WaterproofKey: _waterproofing = value; key = NoKey; break;
+    case GrowthKey: _growthRate = value; key = NoKey; break;
+    case RazorsKey: _razorCount = value; key = NoKey; break;
+    case TrampolineKey:
+      trampoline = token[0] - FirstTrampoline + 1;
+      key = TrampolineTargetKey;
+      break;
+    case TrampolineTargetKey: key = TargetKey; break;
+    case TargetKey:
+      _trampolineTarget[trampoline] = token[0] - FirstTarget + 1;
+      _trampolineCount++;
+      key = NoKey;
+      break;
+    default: key = NoKey; break;
+    }
+    token.clear();
+  }
+}
+
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::clear()
+{
+  _width = _height = _stride = _size = _current = 0;
+  _robot = _robotY = _lift = 0;
+  _waterLevel = _floodingRate = _usedWaterproofing = 0;
+  _waterproofing = 10;
+  _growthRate = 25;
+  _bearded = false;
+  _razorCount = _lambdaCount = _collectedCount = _trampolineCount = 0;
+  std::fill(_trampoline, _trampoline + MaxTrampolineCount + 1, 0);
+  std::fill(_target, _target + MaxTrampolineCount + 1, 0);
+  std::fill(_trampolineTarget, _trampolineTarget + MaxTrampolineCount + 1, 0);
+  _moveCount = _score = 0;
+  _condition = None;
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::execute(Move m)
+{
+  Object *c = cells();
+  if (isStep(m)) {
+    int d = m == MoveLeft ? -1 : m == MoveRight ? 1 : m == MoveUp ? _stride : -_stride;
+    int to = _robot + d;
+    Object o = c[to];
+    if (o == Empty || o == Earth) {
+      moveRobot(to);
+    } else if (o == Lambda) {
+      moveRobot(to);
+      _collectedCount++;
+      _score += 50;
+    } else if ((RuleSet & BeardRules) && o == Razor) {
+      moveRobot(to);
+      _razorCount++;
+    } else if (o == OpenLift) {
+      c[_robot] = Empty;
+      _robot = to;
+      _robotY = indexToY(to);
+      _score += _collectedCount * 25;
+      _condition = Win;
+    } else if (isRock(o, RuleSet) && (d == 1 || d == -1) && c[to + d] == Empty) {
+      moveRobot(to);
+      c[to + d] = o;
+    } else if ((RuleSet & TrampolineRules) && isTrampoline(o)) {
+      moveRobot(to);
+      clearSimilarTrampolines(o);
+    }
+    _moveCount++;
+    _score--;
+  } else if (m == MoveShave) {
+    if (RuleSet & BeardRules)
+      shaveBeard();
+    _moveCount++;
+    _score--;
+  } else if (m == MoveWait) {
+    _moveCount++;
+    _score--;
+  } else if (m == MoveAbort) {
+    _condition = Aborted;
+  }
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::moveRobot(int to)
+{
+  Object o = cells()[to];
+  if ((RuleSet & TrampolineRules) && isTrampoline(o))
+    teleportRobot(_target[_trampolineTarget[o - FirstTrampoline + 1]]);
+  else
+    teleportRobot(to);
+  if ((RuleSet & WaterRules) && _usedWaterproofing && robotY() > _waterLevel)
+    _usedWaterproofing = 0;
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::teleportRobot(int to)
+{
+  Object *c = cells();
+  c[_robot] = Empty;
+  _robot = to;
+  _robotY = indexToY(to);
+  c[to] = Robot;
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::clearSimilarTrampolines(Object trampoline)
+{
+  Object *c = cells();
+  int target = _trampolineTarget[trampoline - FirstTrampoline + 1];
+  for (int i = 1; i <= MaxTrampolineCount; i++) {
+    if (_trampolineTarget[i] == target) {
+      if (_trampoline[i])
+        c[_trampoline[i]] = Empty;
+      _trampoline[i] = 0;
+      _trampolineTarget[i] = 0;
+      _trampolineCount--;
+    }
+  }
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::shaveBeard()
+{
+  if (!_razorCount)
+    return;
+  Object *c = cells();
+  for (int dy = -_stride; dy <= _stride; dy += _stride)
+    for (int dx = -1; dx <= 1; dx++)
+      if (c[_robot + dy + dx] == Beard)
+        c[_robot + dy + dx] = Empty;
+  _razorCount--;
+}
+
+
+// Reads the current generation and writes the next, scanning from the bottom
+// row up and left to right, exactly as update_world() does.
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::update()
+{
+  const Object *c = cells();
+  Object *n = nextCells();
+  std::copy(c, c + _size, n);
+  bool grow = (RuleSet & BeardRules) && _bearded && _growthRate && !(_moveCount % _growthRate);
+  bool open = _collectedCount == _lambdaCount;
+  int i = index(1, 1), end = index(_width, _height) + 1;
+  for (; i + 8 <= end; i += 8)
+    if (mayChange(c + i, grow, open))
+      for (int j = i; j < i + 8; j++)
+        if (mayChange(c[j], grow, open))
+          updateCell(c, n, j, grow, open);
+  for (; i < end; i++)
+    if (mayChange(c[i], grow, open))
+      updateCell(c, n, i, grow, open);
+  _current = _size - _current;
+  if (_condition != None)
+    return;
+  if (RuleSet & WaterRules) {
+    if (robotY() <= _waterLevel && ++_usedWaterproofing > _waterproofing) {
+      _score -= _collectedCount * 25;
+      _condition = Lose;
+    }
+    if (_floodingRate && !(_moveCount % _floodingRate))
+      _waterLevel++;
+  }
+  if (_moveCount == _width * _height)
+    _condition = Aborted;
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::updateCell(const Object *c, Object *n, int i, bool grow, bool open)
+{
+  Object o = c[i];
+  if (isRock(o, RuleSet)) {
+    int down = i - _stride;
+    Object below = c[down];
+    if (below == Empty) {
+      n[i] = Empty;
+      n[down] = o;
+      dropRock(c, n, o, down);
+    } else if (isRock(below, RuleSet) && c[i + 1] == Empty && c[down + 1] == Empty) {
+      n[i] = Empty;
+      n[down + 1] = o;
+      dropRock(c, n, o, down + 1);
+    } else if (isRock(below, RuleSet) && c[i - 1] == Empty && c[down - 1] == Empty) {
+      n[i] = Empty;
+      n[down - 1] = o;
+      dropRock(c, n, o, down - 1);
+    } else if (below == Lambda && c[i + 1] == Empty && c[down + 1] == Empty) {
+      n[i] = Empty;
+      n[down + 1] = o;
+      dropRock(c, n, o, down + 1);
+    }
+  } else if (grow && o == Beard) {
+    for (int dy = -_stride; dy <= _stride; dy += _stride)
+      for (int dx = -1; dx <= 1; dx++)
+        if (c[i + dy + dx] == Empty)
+          n[i + dy + dx] = Beard;
+  } else if (open && o == ClosedLift) {
+    n[i] = OpenLift;
+  }
+}
+
+template <class Storage, unsigned RuleSet>
+void Engine<Storage, RuleSet>::dropRock(const Object *c, Object *n, Object rock, int at)
+{
+  if (_condition != None)
+    return;
+  Object below = c[at - _stride];
+  if (below == Robot) {
+    _score -= _collectedCount * 25;
+    _condition = Lose;
+  }
+  if ((RuleSet & HoRockRules) && below != Empty && rock == HoRock)
+    n[at] = Lambda;
+}
+
+}
+
+#endif
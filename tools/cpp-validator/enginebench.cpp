@@ -0,0 +1,127 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+#include "vm.h"
+
+// Replays the same random move strings on each map with libvm and with the
+// engine in engine.h, checks that they agree, and reports moves per second.
+
+static const char moveChars[] = "LRUDWS";
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static long benchVm(const char *path, const std::vector<std::string> &moves, std::vector<long> &scores, double &seconds)
+{
+  struct state *s0 = vm_new_from_file(path);
+  long moveCount = 0;
+  Clock::time_point start = Clock::now();
+  for (unsigned int i = 0; i < moves.size(); ++i) {
+    struct state *s = vm_make_moves(s0, moves[i].c_str());
+    moveCount += vm_get_move_count(s);
+    scores[i] = vm_get_score(s);
+    vm_free(s);
+  }
+  seconds = secondsSince(start);
+  vm_free(s0);
+  return moveCount;
+}
+
+template <class E>
+static long benchEngine(const std::string &map, const std::vector<std::string> &moves, std::vector<long> &scores, double &seconds)
+{
+  E e0, e;
+  e0.load(map);
+  long moveCount = 0;
+  Clock::time_point start = Clock::now();
+  for (unsigned int i = 0; i < moves.size(); ++i) {
+    e = e0;
+    e.replay(moves[i].c_str());
+    moveCount += e.moveCount();
+    scores[i] = e.score();
+  }
+  seconds = secondsSince(start);
+  return moveCount;
+}
+
+static void report(const char *name, long moveCount, double seconds, double baseSeconds)
+{
+  std::cout << "  " << name << ": " << moveCount / seconds / 1e6 << " Mmoves/s";
+  if (baseSeconds)
+    std::cout << " (" << baseSeconds / seconds << "x)";
+  std::cout << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<const char *> paths;
+  int replayCount = 10000, moveCount = 200;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-n" && i + 1 < argc)
+      replayCount = std::atoi(argv[++i]);
+    else if (arg == "-m" && i + 1 < argc)
+      moveCount = std::atoi(argv[++i]);
+    else
+      paths.push_back(argv[i]);
+  }
+  if (paths.empty()) {
+    std::cerr << "Usage: ./enginebench <map>... [-n replays] [-m moves]" << std::endl;
+    return 1;
+  }
+
+  std::srand(1);
+  std::vector<std::string> moves(replayCount);
+  for (int i = 0; i < replayCount; ++i)
+    for (int j = 0; j < moveCount; ++j)
+      moves[i] += moveChars[std::rand() % (sizeof(moveChars) - 1)];
+
+  bool agreed = true;
+  for (unsigned int p = 0; p < paths.size(); ++p) {
+    std::ifstream mapFile(paths[p]);
+    if (mapFile.fail()) {
+      std::cerr << "Could not open " << paths[p] << "." << std::endl;
+      return 2;
+    }
+    std::string map((std::istreambuf_iterator<char>(mapFile)), std::istreambuf_iterator<char>());
+    std::vector<long> vmScores(replayCount), scores(replayCount);
+    double vmSeconds, seconds;
+
+    std::cout << paths[p] << std::endl;
+    long vmMoveCount = benchVm(paths[p], moves, vmScores, vmSeconds);
+    report("libvm", vmMoveCount, vmSeconds, 0);
+
+    long n = benchEngine<engine::Engine<engine::VectorCells> >(map, moves, scores, seconds);
+    report("engine, VectorCells", n, seconds, vmSeconds);
+    if (n != vmMoveCount || scores != vmScores)
+      agreed = false;
+
+    try {
+      n = benchEngine<engine::Engine<engine::FixedCells<1 << 15> > >(map, moves, scores, seconds);
+      report("engine, FixedCells", n, seconds, vmSeconds);
+      if (n != vmMoveCount || scores != vmScores)
+        agreed = false;
+    } catch (const std::length_error &) {
+      std::cout << "  engine, FixedCells: map too large" << std::endl;
+    }
+
+    if (!agreed) {
+      std::cout << "engines disagree" << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "engine.h"
+
+// Reads moves from stdin and behaves like bin/validator, using the engine in
+// engine.h instead of libvm.
+int main(int argc, char **argv)
+{
+  bool vvMode = false;
+  
+  if (argc < 2) {
+    std::cerr << "Usage: echo <moves> | ./lambdaengine [-v|-vv] <map>" << std::endl;
+    return 1;
+  }
+  
+  int fileArg = argc - 1;
+  
+  if (argc == 3 && std::string(argv[1]) == std::string("-vv"))
+    vvMode = true;
+  
+  std::ifstream mapFile(argv[fileArg]);
+  if (mapFile.fail()) {
+    std::cerr << "Could not open map." << std::endl;
+    return 2;
+  }
+  std::string map((std::istreambuf_iterator<char>(mapFile)), std::istreambuf_iterator<char>());
+  std::string moves((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+  
+  engine::Engine<> e;
+  e.load(map);
+  e.replay(moves.c_str());
+  
+  if (vvMode)
+    std::cout << e;
+  else
+    std::cout << e.score() << std::endl;
+  
+  return 0;
+}
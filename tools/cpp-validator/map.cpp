@@ -1,5 +1,6 @@
 #include "map.h"
 
+#include <algorithm>
 #include <istream>
 
 using std::string;
@@ -7,6 +8,7 @@ using std::string;
 std::istream &Map::operator<<(std::istream &stream) 
 {
   string tmp;
+  std::vector<string> lines;
   
   int y = 0;
   
@@ -20,7 +22,7 @@ std::istream &Map::operator<<(std::istream &stream)
         continue;
       }
     
-      data.push_back(tmp);
+      lines.push_back(tmp);
       int x = analyze(tmp);
       if (x >= 0)
         _robotPosition = Position(x, y);
@@ -41,16 +43,40 @@ std::istream &Map::operator<<(std::istream &stream)
     }
   }
   
+  build(lines);
   return stream;
 }
 
+// Short lines are padded with empty tiles, but printed at their own width.
+void Map::build(const std::vector<string> &lines)
+{
+  _height = lines.size();
+  _width = 0;
+  _lineWidths.clear();
+  for (unsigned int y = 0; y < lines.size(); ++y) {
+    _lineWidths.push_back(lines[y].size());
+    if ((int) lines[y].size() > _width)
+      _width = lines[y].size();
+  }
+  _stride = _width + 2;
+  
+  _buffer.assign(2 * _stride * (_height + 2), Wall);
+  _cells = &_buffer[0];
+  _next = _cells + _stride * (_height + 2);
+  for (int y = 0; y < _height; ++y)
+    for (int x = 0; x < _width; ++x)
+      _cells[index(Position(x, y))] = x < (int) lines[y].size() ? lines[y][x] : (Tile) Empty;
+  std::copy(_cells, _next, _next);
+  _dirty.clear();
+}
+
 std::ostream &operator<<(std::ostream &stream, const Map &map)
 {
-  unsigned int water = map.data.size() - map._water;
+  unsigned int water = map._height - map._water;
   
-  for (unsigned int i = 0; i < map.data.size(); ++i) {
-    stream << map.data[i];
-    if (!map._vvMode && i == water)
+  for (int i = 0; i < map._height; ++i) {
+    stream.write(map._cells + map.index(Map::Position(0, i)), map._lineWidths[i]);
+    if (!map._vvMode && (unsigned int) i == water)
       stream << "~";
     stream << std::endl;
   }
@@ -62,33 +88,39 @@ void Map::update()
 {
   _moves++;
   
-  MapData newMap(data);
-
-  for (unsigned int y = 0; y < data.size(); ++y) {
-    for (unsigned int x = 0; x < data[y].size(); ++x) {
-      Position pos{x, y};
-      if (tile(pos) == Rock) {
-        Position rockPos{pos};
-        if (tile(pos.down()) == Empty) {
-          rockPos = pos.down();
-        } else if (tile(pos.down()) == Rock) {
-          if (tile(pos.right()) == Empty && tile(pos.down().right()) == Empty) {
-            rockPos = pos.down().right();
-          } else if (tile(pos.left()) == Empty && tile(pos.down().left()) == Empty) {
-            rockPos = pos.down().left();
+  for (unsigned int i = 0; i < _dirty.size(); ++i)
+    _next[_dirty[i]] = _cells[_dirty[i]];
+  _dirty.clear();
+  
+  const int down = _stride;
+  for (int y = 0; y < _height; ++y) {
+    for (int i = index(Position(0, y)), end = i + _width; i < end; ++i) {
+      if (_cells[i] == Rock) {
+        int rock = i;
+        if (_cells[i + down] == Empty) {
+          rock = i + down;
+        } else if (_cells[i + down] == Rock) {
+          if (_cells[i + 1] == Empty && _cells[i + down + 1] == Empty) {
+            rock = i + down + 1;
+          } else if (_cells[i - 1] == Empty && _cells[i + down - 1] == Empty) {
+            rock = i + down - 1;
           }
-        } else if (tile(pos.down()) == Lambda && tile(pos.right()) == Empty && tile(pos.right().down()) == Empty) {
-          rockPos = pos.down().right();
+        } else if (_cells[i + down] == Lambda && _cells[i + 1] == Empty && _cells[i + down + 1] == Empty) {
+          rock = i + down + 1;
         }
         
-        if (rockPos != pos) {
-          newMap.tile(pos) = Empty;
-          newMap.tile(rockPos) = Rock;
-          if (tile(rockPos.down()) == Robot)
+        if (rock != i) {
+          _next[i] = Empty;
+          _next[rock] = Rock;
+          _dirty.push_back(i);
+          _dirty.push_back(rock);
+          if (_cells[rock + down] == Robot)
             _robotHit = true;
         }
-      } else if (tile(pos) == ClosedLift && !_lambdas)
-        newMap.tile(pos) = OpenLift;
+      } else if (_cells[i] == ClosedLift && !_lambdas) {
+        _next[i] = OpenLift;
+        _dirty.push_back(i);
+      }
     }
   }
 
@@ -98,12 +130,12 @@ void Map::update()
   else
     _drank = 0;
   
-  data = newMap;
+  std::swap(_cells, _next);
 }
 
 void Map::flood()
 {
-  if (_water == data.size())
+  if (_water == (unsigned int) _height)
     return;
   
   _ticks++;
@@ -115,7 +147,7 @@ void Map::flood()
 
 bool Map::robotUnderwater() const
 {
-  return (unsigned int) _robotPosition.y >= data.size() - _water;
+  return (unsigned int) _robotPosition.y >= _height - _water;
 }
 
 void Map::robotTakesWater()
@@ -145,10 +177,7 @@ std::string Map::condition() const
 
 bool Map::moveRobot(const Position &newPos)
 {
-  if (newPos.x < 0 || newPos.y < 0)
-    return false;
-  
-  Tile target = data[newPos.y][newPos.x];
+  Tile target = tile(newPos);
   
   bool moved = false;
   
@@ -177,17 +206,17 @@ bool Map::moveRobot(const Position &newPos)
     case Rock:
       if (newPos == robotPosition().right() && tile(newPos.right()) == Empty) {
         moved = true;
-        tile(newPos.right()) = Rock;
+        set(newPos.right(), Rock);
       } else if (newPos == robotPosition().left() && tile(newPos.left()) == Empty) {
         moved = true;
-        tile(newPos.left()) = Rock;
+        set(newPos.left(), Rock);
       }
       break;
   }
   
   if (moved) {
-    tile(robotPosition()) = Empty;
-    tile(newPos) = Robot;
+    set(robotPosition(), Empty);
+    set(newPos, Robot);
     _robotPosition = newPos;
   }
   
@@ -8,6 +8,7 @@
 class Map {
 public:
   Map() : 
+    _cells(0), _next(0), _width(0), _height(0), _stride(0),
     _lambdas(0), _collected(0), _moves(-1), 
     _water(0), _flooding(0), _waterproof(10),
     _drank(0), _ticks(0),
@@ -39,8 +40,8 @@ public:
   };
   
   typedef char Tile;
-  Tile &tile(const Position &pos) {
-    return data.tile(pos);
+  Tile tile(const Position &pos) const {
+    return _cells[index(pos)];
   }
   
   enum {
@@ -67,14 +68,26 @@ public:
   void setVv(bool state = true) { _vvMode = state; }
 
 private:
-  class MapData : public std::vector<std::string> {
-  public:
-    Tile &tile(const Position &pos) {
-      return (*this)[pos.y][pos.x];
-    }
-  };
-  MapData data;
-  
+  // The grid lives in one buffer holding two generations of
+  // _stride * (_height + 2) tiles each, with a border of walls all around so
+  // that neighbours need no bounds checks.  update() reads _cells and writes
+  // _next, then swaps them; the tiles changed since the last swap are listed
+  // in _dirty, which is all it takes to bring _next up to date again.
+  std::vector<Tile> _buffer;
+  Tile *_cells, *_next;
+  std::vector<int> _dirty;
+  std::vector<int> _lineWidths;
+  int _width, _height, _stride;
+
+  int index(const Position &pos) const {
+    return (pos.y + 1) * _stride + pos.x + 1;
+  }
+  void set(const Position &pos, Tile t) {
+    _cells[index(pos)] = t;
+    _dirty.push_back(index(pos));
+  }
+  void build(const std::vector<std::string> &lines);
+
   int analyze(const std::string &line);
   void flood();
   bool robotUnderwater() const;
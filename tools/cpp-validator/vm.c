@@ -0,0 +1,59 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libvm.h"
+#include "search.h"
+#include "vm.h"
+
+
+struct state *vm_new_from_file(const char *path) {
+    return new_from_file(path);
+}
+
+struct state *vm_copy(const struct state *s) {
+    return copy(s);
+}
+
+void vm_free(struct state *s) {
+    free(s);
+}
+
+
+struct state *vm_make_one_move(const struct state *s, char move) {
+    return make_one_move(s, move);
+}
+
+struct state *vm_make_moves(const struct state *s, const char *moves) {
+    return make_moves(s, moves);
+}
+
+// Makes the move in place; scratch must be a copy of a state of the same map.
+void vm_apply_move(struct state *s, struct state *scratch, char move) {
+    apply_move(s, scratch, s, move);
+}
+
+
+long vm_get_move_count(const struct state *s) {
+    return get_move_count(s);
+}
+
+long vm_get_score(const struct state *s) {
+    return get_score(s);
+}
+
+char vm_get_condition(const struct state *s) {
+    return get_condition(s);
+}
+
+// The world as rows from the top, each ending in a newline.
+const char *vm_get_world(const struct state *s, long *out_world_length) {
+    DEBUG_ASSERT(s && out_world_length);
+    *out_world_length = s->world_length - 1;
+    return s->world;
+}
@@ -0,0 +1,29 @@
+#ifndef VM_H
+#define VM_H
+
+// The parts of libvm that the C++ tools need.  libvm.h itself cannot be
+// included from C++, as it declares a function called new().
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct state;
+
+struct state *vm_new_from_file(const char *path);
+struct state *vm_copy(const struct state *s);
+void vm_free(struct state *s);
+
+struct state *vm_make_one_move(const struct state *s, char move);
+struct state *vm_make_moves(const struct state *s, const char *moves);
+void vm_apply_move(struct state *s, struct state *scratch, char move);
+
+long vm_get_move_count(const struct state *s);
+long vm_get_score(const struct state *s);
+char vm_get_condition(const struct state *s);
+const char *vm_get_world(const struct state *s, long *out_world_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,7 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,6 +10,18 @@
 
 #include "libvm.h"
 
+#define DEFAULT_TIME_LIMIT 140
+#define PENALTY_ARM_COUNT 10
+#define MAX_NOISE 30
+
+// Penalties for cells under rocks tried by the scheduler in main.
+static const int penalty_arm[PENALTY_ARM_COUNT] = {1, 2, 3, 5, 8, 13, 21, 34, 55, 80};
+
+double get_time(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
 
 //reverse string (str, 0, strlen-1)
 void reverse(char *x, int beg, int end){
@@ -67,7 +82,7 @@ int goSomewhere(struct state *s, char **a, int penalty){
 	do{
 	    free(s);
 	    s = copy(ns);
-		update_world(ns, s);
+		update_world(ns, s, true);
 		change++;
 		stage++;
 		end = 0;
@@ -155,55 +170,114 @@ int goSomewhere(struct state *s, char **a, int penalty){
 		answer[0]='\0';
      	*a=answer;
 		free(c);
+		free(s);
+		free(ns);
 		return 1;
 	}
 	*a=answer;
 	free(c);
+	free(s);
+	free(ns);
 	return 0;
 }
 
-int main(int argc, char *argv[]){
-	struct state *s = new_from_file(argv[1]);
-	struct state *t, *s0;
+// Plays one restart from s0 into result, taking a random move instead of the
+// planned one noise percent of the time, until it can no longer beat
+// best_score.
+struct state *restart(struct state *s0, char *result, int penalty, int noise, long best_score){
+	struct state *s, *t, *u;
 	char *answer;
-	int status, stage, i, j, bestv=0;
-	char *result = malloc (((s-> world_w+1) * s->world_h * sizeof(char)));
-	char *best = malloc (((s-> world_w+1) * s->world_h * sizeof(char)));
-
-	s0 = copy(s);
-	srand(time(NULL));
-
-  for(j=1; j<150; j++){
-    stage=0;
+	int status, stage=0;
+	long result_length=0;
 	strcpy(result, "");
-	free(s);
 	s = copy(s0);
-	i= j%80+1;
-		
 	do{
 		t = copy(s);
-		status=goSomewhere(t, &answer, i);
-//		free(t);
+		status=goSomewhere(t, &answer, penalty);
 		t = copy(s);
-		if(status==0) 
-			s = make_moves(s, answer);
-		if(status==1 || s->condition == C_LOSE || (j>30 && rand()*100>180-j)){
+		if(status==0){
+			u = make_moves(s, answer);
 			free(s);
+			s = u;
+		}
+		if(status==1 || s->condition == C_LOSE || rand()%100 < noise){
+			free(s);
+			free(answer);
 			s=copy(t);
-			anyMove(t, &answer, rand()*5);
+			anyMove(t, &answer, rand()%5);
 			stage++;
-     		s = make_moves(s, answer);
+			u = make_moves(s, answer);
+			free(s);
+			s = u;
 		}
-		strcat(result, answer);
+		strcpy(result+result_length, answer);
+		result_length += strlen(answer);
+		free(answer);
 		free(t);
-	}while(s->condition == C_NONE && stage < s->world_h*8 && s->score>-1000 );
-	
-	s = make_moves(s0, result);
+	}while(s->condition == C_NONE && stage < s->world_h*8 && get_score_bound(s) > best_score);
+	free(s);
+	return make_moves(s0, result);
+}
+
+// UCB1 over the penalty arms, trying each once first.  A restart pays off if
+// it scores at least as well as the best so far.
+int choose_arm(const int *pulls, const double *reward, int pull_count){
+	double value, best_value = -1;
+	int arm, best_arm = 0;
+	for(arm=0; arm<PENALTY_ARM_COUNT; arm++){
+		if(pulls[arm]==0)
+			return arm;
+		value = reward[arm]/pulls[arm] + sqrt(2*log(pull_count)/pulls[arm]);
+		if(value > best_value){
+			best_value = value;
+			best_arm = arm;
+		}
+	}
+	return best_arm;
+}
+
+// Restarts until the time limit, given in seconds as the second argument, is
+// about to run out, or until the second half of all restarts so far has
+// brought no improvement.  The cost of a restart is measured as it goes, and
+// randomisation grows with the share of the time limit used up.
+int main(int argc, char *argv[]){
+	struct state *s, *s0;
+	int j, arm, noise, best_j=0, bestv=0;
+	int pulls[PENALTY_ARM_COUNT] = {0};
+	double reward[PENALTY_ARM_COUNT] = {0};
+	double time_limit, start, restart_start, elapsed, cost=0;
+	char *result, *best;
+
+	if(argc < 2)
+		LOG_EXIT("Usage: %s <map> [<seconds>]\n", argv[0]);
+	s0 = new_from_file(argv[1]);
+	time_limit = argc > 2 ? atof(argv[2]) : DEFAULT_TIME_LIMIT;
+	result = malloc (2 * (s0->world_w+1) * s0->world_h + 2);
+	best = malloc (2 * (s0->world_w+1) * s0->world_h + 2);
+	strcpy(best, "");
+	srand(time(NULL));
+	start = get_time();
+
+  for(j=1; ; j++){
+	elapsed = get_time() - start;
+	if(j > 1 && elapsed + 2*cost > time_limit)
+		break;
+	if(j > 5*PENALTY_ARM_COUNT && j - best_j > j/2)
+		break;
+	arm = choose_arm(pulls, reward, j-1);
+	noise = pulls[arm] ? 1 + (int)(MAX_NOISE * elapsed / time_limit) : 0;
+	restart_start = get_time();
+	s = restart(s0, result, penalty_arm[arm], noise, bestv);
+	cost = j==1 ? get_time() - restart_start : 0.8*cost + 0.2*(get_time() - restart_start);
+	pulls[arm]++;
+	reward[arm] += s->score > 0 && s->score >= bestv;
 	printf("%d: %ld\n", j, s->score);
 	if(s->score > bestv){
 		strcpy(best, result);
 		bestv = s->score;
+		best_j = j;
 	}
+	free(s);
   }
   s = make_moves(s0, best);
   dump(s);
@@ -0,0 +1,403 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libvm.h"
+#include "batch.h"
+#include "binmap.h"
+#include "cache.h"
+#include "optimize.h"
+#include "search.h"
+
+
+#define MAX_SERVED_MAP_COUNT 64
+#define MAX_COMMAND_LENGTH 32
+#define SERVER_BACKLOG 64
+
+// A rough rate for one search thread on a mid-sized map, used to turn the
+// half of a solve budget given to search into a node count.
+#define SEARCH_NODES_PER_SECOND 50000
+
+
+// A parsed map, kept between requests along with the best moves known for
+// it.  The table holds one reference, and each request using it another.
+struct served_map {
+    unsigned long text_hash;
+    char *text;
+    long text_length;
+    struct state *s0;
+    long reference_count;
+    long last_used;
+    pthread_mutex_t best_mutex;
+    char *best_moves;
+    long best_score;
+};
+
+struct server {
+    pthread_mutex_t mutex;
+    pthread_cond_t connection_cond;
+    struct served_map *map[MAX_SERVED_MAP_COUNT];
+    long map_count;
+    long clock;
+    int *pending_fd;
+    long pending_count;
+    long solve_thread_count;
+};
+
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+unsigned long hash_text(const char *text, long length) {
+    unsigned long h = 14695981039346656037UL;
+    long i;
+    for (i = 0; i < length; i++)
+        h = (h ^ (unsigned char)text[i]) * 1099511628211UL;
+    return h;
+}
+
+
+void release_served_map(struct server *sv, struct served_map *m) {
+    long reference_count;
+    pthread_mutex_lock(&sv->mutex);
+    reference_count = --m->reference_count;
+    pthread_mutex_unlock(&sv->mutex);
+    if (reference_count)
+        return;
+    free_analysis((struct analysis *)m->s0->analysis);
+    free(m->s0);
+    free(m->text);
+    free(m->best_moves);
+    pthread_mutex_destroy(&m->best_mutex);
+    free(m);
+}
+
+// Called with the server mutex held.
+struct served_map *find_served_map(struct server *sv, const char *text, long length, unsigned long h) {
+    struct served_map *m;
+    long i;
+    for (i = 0; i < sv->map_count; i++) {
+        m = sv->map[i];
+        if (m->text_hash == h && m->text_length == length && !memcmp(m->text, text, length)) {
+            m->reference_count++;
+            m->last_used = ++sv->clock;
+            return m;
+        }
+    }
+    return NULL;
+}
+
+// Finds the map in the table, or parses it and puts it there, dropping the
+// least recently used map when the table is full.  Maps are parsed outside
+// the lock, so a map sent by two clients at once may be parsed twice, and
+// the second copy dropped.
+struct served_map *get_served_map(struct server *sv, const char *text, long length) {
+    struct served_map *m, *n, *evicted = NULL;
+    unsigned long h = hash_text(text, length);
+    long i, j;
+    pthread_mutex_lock(&sv->mutex);
+    m = find_served_map(sv, text, length, h);
+    pthread_mutex_unlock(&sv->mutex);
+    if (m)
+        return m;
+    if (!(n = calloc(1, sizeof(struct served_map))) || !(n->text = malloc(length)))
+        PERROR_EXIT("malloc");
+    memcpy(n->text, text, length);
+    n->text_hash = h;
+    n->text_length = length;
+    n->s0 = new(length, text);
+    n->best_score = LONG_MIN;
+    pthread_mutex_init(&n->best_mutex, NULL);
+    pthread_mutex_lock(&sv->mutex);
+    if ((m = find_served_map(sv, text, length, h))) {
+        n->reference_count = 1;
+        evicted = n;
+    } else {
+        m = n;
+        m->reference_count = 2;
+        m->last_used = ++sv->clock;
+        if (sv->map_count == MAX_SERVED_MAP_COUNT) {
+            for (i = j = 0; i < sv->map_count; i++)
+                if (sv->map[i]->last_used < sv->map[j]->last_used)
+                    j = i;
+            evicted = sv->map[j];
+            sv->map[j] = m;
+        } else
+            sv->map[sv->map_count++] = m;
+    }
+    pthread_mutex_unlock(&sv->mutex);
+    if (evicted)
+        release_served_map(sv, evicted);
+    return m;
+}
+
+// Keeps the moves if they beat the best known for the map, and caches them on
+// disk.  Returns their score.
+long note_solution(struct served_map *m, const char *moves, const char *found_by) {
+    struct state *s;
+    bool improved = false;
+    long score;
+    s = make_moves(m->s0, moves);
+    score = get_score(s);
+    free(s);
+    pthread_mutex_lock(&m->best_mutex);
+    if (score > m->best_score) {
+        free(m->best_moves);
+        if (!(m->best_moves = strdup(moves)))
+            PERROR_EXIT("strdup");
+        m->best_score = score;
+        improved = true;
+    }
+    pthread_mutex_unlock(&m->best_mutex);
+    if (improved)
+        save_solution(m->s0, moves, found_by);
+    return score;
+}
+
+char *get_best_moves(struct served_map *m, long *out_score) {
+    char *moves = NULL;
+    pthread_mutex_lock(&m->best_mutex);
+    if (m->best_moves && !(moves = strdup(m->best_moves)))
+        PERROR_EXIT("strdup");
+    *out_score = m->best_score;
+    pthread_mutex_unlock(&m->best_mutex);
+    return moves;
+}
+
+
+// Starts from the best moves known, in memory or on disk, then spends half
+// the budget searching and the rest optimizing the best moves found.
+void solve(struct server *sv, struct served_map *m, double time_limit, FILE *body) {
+    char *moves;
+    long score;
+    double start = get_time(), left;
+    if (!(moves = get_best_moves(m, &score)) && (moves = load_solution(m->s0, &score)))
+        note_solution(m, moves, "cache");
+    free(moves);
+    moves = search(m->s0, sv->solve_thread_count, time_limit / 2 * SEARCH_NODES_PER_SECOND * sv->solve_thread_count, NULL);
+    note_solution(m, moves, "lifter-server search");
+    free(moves);
+    moves = get_best_moves(m, &score);
+    if ((left = time_limit - (get_time() - start)) > 0) {
+        char *optimized = optimize(m->s0, moves, sv->solve_thread_count, left, NULL);
+        note_solution(m, optimized, "lifter-server optimize");
+        free(optimized);
+        free(moves);
+        moves = get_best_moves(m, &score);
+    }
+    fprintf(body, "%ld %s\n", score, moves);
+    free(moves);
+}
+
+void validate(struct served_map *m, const char *moves, FILE *body) {
+    struct state *s;
+    s = make_moves(m->s0, moves);
+    fprintf(body, "%ld %c %ld\n%s", get_score(s), get_condition(s), get_move_count(s), s->world);
+    free(s);
+    note_solution(m, moves, "lifter-server client");
+}
+
+void score_batch(struct served_map *m, char *const *moves, long count, FILE *body) {
+    struct batch *b;
+    long best_k = 0, k;
+    b = evaluate_candidates(m->s0, (const char *const *)moves, count);
+    for (k = 0; k < count; k++) {
+        fprintf(body, "%ld %c %016lx\n", get_batch_score(b, k), get_batch_condition(b, k), get_batch_hash(b, k));
+        if (get_batch_score(b, k) > get_batch_score(b, best_k))
+            best_k = k;
+    }
+    free(b);
+    note_solution(m, moves[best_k], "lifter-server client");
+}
+
+
+char *read_line(FILE *in) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    if ((length = getline(&line, &size, in)) == -1) {
+        free(line);
+        return NULL;
+    }
+    if (length && line[length - 1] == '\n')
+        line[length - 1] = 0;
+    return line;
+}
+
+// Serves one request.  Returns false when the client has gone, or has sent
+// something that cannot be framed, after which the connection is closed.
+bool serve_request(struct server *sv, FILE *in, FILE *out) {
+    char *header, command[MAX_COMMAND_LENGTH], *text = NULL, **moves = NULL, *error = NULL, *body;
+    struct served_map *m = NULL;
+    size_t body_size;
+    long map_length, count = 0, i;
+    double time_limit = 0;
+    bool framed = false;
+    FILE *f;
+    if (!(header = read_line(in)))
+        return false;
+    if (sscanf(header, "solve %ld %lf", &map_length, &time_limit) == 2)
+        framed = time_limit >= 0;
+    else if (sscanf(header, "validate %ld", &map_length) == 1) {
+        framed = true;
+        count = 1;
+    } else if (sscanf(header, "score-batch %ld %ld", &map_length, &count) == 2)
+        framed = count > 0;
+    sscanf(header, "%31s", command);
+    free(header);
+    if (!framed || map_length <= 0) {
+        fprintf(out, "error bad request\n");
+        fflush(out);
+        return false;
+    }
+    if (!(text = malloc(map_length)) || !(moves = calloc(count ? count : 1, sizeof(char *))))
+        PERROR_EXIT("malloc");
+    framed = fread(text, 1, map_length, in) == (size_t)map_length;
+    for (i = 0; framed && i < count; i++)
+        framed = (moves[i] = read_line(in)) != NULL;
+    if (!framed)
+        goto done;
+    if (is_binary_map(map_length, text))
+        error = "compiled maps are not served";
+    else if (!(m = get_served_map(sv, text, map_length))->s0->robot_x)
+        error = "no robot";
+    if (error) {
+        fprintf(out, "error %s\n", error);
+        fflush(out);
+        goto done;
+    }
+    if (!(f = open_memstream(&body, &body_size)))
+        PERROR_EXIT("open_memstream");
+    if (!strcmp(command, "solve"))
+        solve(sv, m, time_limit, f);
+    else if (!strcmp(command, "validate"))
+        validate(m, moves[0], f);
+    else
+        score_batch(m, moves, count, f);
+    fclose(f);
+    fprintf(out, "ok %ld\n", (long)body_size);
+    fwrite(body, 1, body_size, out);
+    fflush(out);
+    free(body);
+done:
+    if (m)
+        release_served_map(sv, m);
+    for (i = 0; i < count; i++)
+        free(moves[i]);
+    free(moves);
+    free(text);
+    return framed && !ferror(out);
+}
+
+void serve_connection(struct server *sv, int in_fd, int out_fd) {
+    FILE *in, *out;
+    if (!(in = fdopen(in_fd, "r")) || !(out = fdopen(out_fd, "w")))
+        PERROR_EXIT("fdopen");
+    while (serve_request(sv, in, out))
+        ;
+    fclose(in);
+    fclose(out);
+}
+
+
+void add_connection(struct server *sv, int fd) {
+    pthread_mutex_lock(&sv->mutex);
+    if (!(sv->pending_fd = realloc(sv->pending_fd, (sv->pending_count + 1) * sizeof(int))))
+        PERROR_EXIT("realloc");
+    sv->pending_fd[sv->pending_count++] = fd;
+    pthread_cond_signal(&sv->connection_cond);
+    pthread_mutex_unlock(&sv->mutex);
+}
+
+int take_connection(struct server *sv) {
+    int fd;
+    pthread_mutex_lock(&sv->mutex);
+    while (!sv->pending_count)
+        pthread_cond_wait(&sv->connection_cond, &sv->mutex);
+    fd = sv->pending_fd[0];
+    memmove(sv->pending_fd, sv->pending_fd + 1, --sv->pending_count * sizeof(int));
+    pthread_mutex_unlock(&sv->mutex);
+    return fd;
+}
+
+void *run_worker(void *arg) {
+    struct server *sv = arg;
+    int fd, out_fd;
+    while (true) {
+        fd = take_connection(sv);
+        if ((out_fd = dup(fd)) == -1)
+            PERROR_EXIT("dup");
+        serve_connection(sv, fd, out_fd);
+    }
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+    const char *socket_path = NULL;
+    struct server sv;
+    struct sockaddr_un address;
+    pthread_t thread;
+    long worker_count, i;
+    int listen_fd, fd;
+    memset(&sv, 0, sizeof(struct server));
+    worker_count = count_online_cpus();
+    sv.solve_thread_count = 1;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            worker_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            sv.solve_thread_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            socket_path = argv[++i];
+        else
+            LOG_EXIT("Usage: %s [-j <worker-count>] [-t <solve-thread-count>] [-s <socket>]\n", argv[0]);
+    }
+    if (worker_count < 1)
+        worker_count = 1;
+    if (sv.solve_thread_count < 1)
+        sv.solve_thread_count = 1;
+    pthread_mutex_init(&sv.mutex, NULL);
+    pthread_cond_init(&sv.connection_cond, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if (!socket_path) {
+        serve_connection(&sv, STDIN_FILENO, STDOUT_FILENO);
+        return 0;
+    }
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        LOG_EXIT("%s: socket path too long\n", socket_path);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        PERROR_EXIT("socket");
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+        PERROR_EXIT(socket_path);
+    if (listen(listen_fd, SERVER_BACKLOG) == -1)
+        PERROR_EXIT("listen");
+    for (i = 0; i < worker_count; i++)
+        if (pthread_create(&thread, NULL, run_worker, &sv) || pthread_detach(thread))
+            PERROR_EXIT("pthread_create");
+    LOG("serving on %s with %ld workers\n", socket_path, worker_count);
+    while (true) {
+        if ((fd = accept(listen_fd, NULL, NULL)) == -1)
+            PERROR_EXIT("accept");
+        add_connection(&sv, fd);
+    }
+    return 0;
+}
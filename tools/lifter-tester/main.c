@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libvm.h"
+
+
+#define DEFAULT_TIME_LIMIT  150
+#define DEFAULT_GRACE_TIME  10
+#define DEFAULT_MEMORY_MB   1024
+#define POLL_INTERVAL_MS    50
+
+
+struct run {
+    const char *map_path;
+    const struct state *s0;
+    long index;
+    pid_t pid;
+    int fd;
+    long cpu;
+    double start, interrupt_time, kill_time;
+    char *output;
+    long output_length, output_capacity, line_start;
+    long solution_count, invalid_count;
+    long score, best_score;
+    char *moves;
+    double first_time, best_time;
+    long peak_rss_kb;
+    const char *status;
+    bool interrupted, killed;
+};
+
+struct harness {
+    const char *lifter;
+    double time_limit, grace_time;
+    long memory_limit_kb;
+    long cpu_count;
+    long slot_count;
+    struct run *run;
+    long run_count;
+    long next_run;
+    long running_count;
+    struct run **slot;
+    long page_size_kb;
+};
+
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Lists the .map files in a directory in sorted order.
+char **list_maps(const char *dir, long *out_count) {
+    DIR *d;
+    struct dirent *e;
+    char **path = NULL;
+    long count = 0, n;
+    if (!(d = opendir(dir)))
+        PERROR_EXIT(dir);
+    while ((e = readdir(d))) {
+        n = strlen(e->d_name);
+        if (n < 5 || strcmp(e->d_name + n - 4, ".map"))
+            continue;
+        if (!(path = realloc(path, (count + 1) * sizeof(char *))) || !(path[count] = malloc(strlen(dir) + n + 2)))
+            PERROR_EXIT("malloc");
+        sprintf(path[count++], "%s/%s", dir, e->d_name);
+    }
+    closedir(d);
+    qsort(path, count, sizeof(char *), compare_names);
+    *out_count = count;
+    return path;
+}
+
+
+// Each line the lifter prints is taken as a complete solution, superseding
+// any before it.  Lines with anything but moves in them are counted as invalid.
+void record_solution(struct run *r, char *line, long length, double now) {
+    struct state *s;
+    long i;
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t' || line[length - 1] == '\r'))
+        length--;
+    if (!length)
+        return;
+    for (i = 0; i < length; i++) {
+        if (!is_valid_move(line[i])) {
+            r->invalid_count++;
+            return;
+        }
+    }
+    line[length] = 0;
+    s = make_moves(r->s0, line);
+    r->score = get_score(s);
+    free(s);
+    free(r->moves);
+    if (!(r->moves = strdup(line)))
+        PERROR_EXIT("strdup");
+    if (!r->solution_count++)
+        r->first_time = now - r->start;
+    if (r->solution_count == 1 || r->score > r->best_score) {
+        r->best_score = r->score;
+        r->best_time = now - r->start;
+    }
+}
+
+void read_output(struct run *r, double now) {
+    char *newline;
+    long n;
+    if (r->output_capacity - r->output_length < 4096) {
+        r->output_capacity = 2 * r->output_capacity + 4096;
+        if (!(r->output = realloc(r->output, r->output_capacity + 1)))
+            PERROR_EXIT("realloc");
+    }
+    n = read(r->fd, r->output + r->output_length, r->output_capacity - r->output_length);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return;
+        PERROR_EXIT("read");
+    }
+    if (!n) {
+        close(r->fd);
+        r->fd = -1;
+        record_solution(r, r->output + r->line_start, r->output_length - r->line_start, now);
+        return;
+    }
+    r->output_length += n;
+    while ((newline = memchr(r->output + r->line_start, '\n', r->output_length - r->line_start))) {
+        record_solution(r, r->output + r->line_start, newline - (r->output + r->line_start), now);
+        r->line_start = newline - r->output + 1;
+    }
+}
+
+
+long get_rss_kb(const struct harness *h, pid_t pid) {
+    char path[64];
+    FILE *f;
+    long size, resident;
+    sprintf(path, "/proc/%ld/statm", (long)pid);
+    if (!(f = fopen(path, "r")))
+        return 0;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * h->page_size_kb;
+}
+
+// The lifter runs in its own process group, pinned to one CPU, with the map
+// on its standard input.  The command is run through sh with exec, so that
+// arguments may be given and the pid is still that of the lifter itself.
+void start_run(struct harness *h, struct run *r, long slot) {
+    int pipe_fd[2], map_fd;
+    char *command;
+    cpu_set_t cpus;
+    if (pipe(pipe_fd))
+        PERROR_EXIT("pipe");
+    if (!(command = malloc(strlen(h->lifter) + 6)))
+        PERROR_EXIT("malloc");
+    sprintf(command, "exec %s", h->lifter);
+    r->cpu = slot % h->cpu_count;
+    r->start = get_time();
+    if ((r->pid = fork()) < 0)
+        PERROR_EXIT("fork");
+    if (!r->pid) {
+        setpgid(0, 0);
+        CPU_ZERO(&cpus);
+        CPU_SET(r->cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus))
+            PERROR_EXIT("sched_setaffinity");
+        if ((map_fd = open(r->map_path, O_RDONLY)) < 0)
+            PERROR_EXIT(r->map_path);
+        if (dup2(map_fd, STDIN_FILENO) < 0 || dup2(pipe_fd[1], STDOUT_FILENO) < 0)
+            PERROR_EXIT("dup2");
+        close(map_fd);
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        PERROR_EXIT("execl");
+    }
+    setpgid(r->pid, r->pid);
+    free(command);
+    close(pipe_fd[1]);
+    r->fd = pipe_fd[0];
+    r->interrupt_time = r->start + h->time_limit;
+    r->kill_time = r->interrupt_time + h->grace_time;
+    h->slot[slot] = r;
+    h->running_count++;
+}
+
+void finish_run(struct harness *h, struct run *r, long slot) {
+    struct rusage usage;
+    int status;
+    if (wait4(r->pid, &status, 0, &usage) < 0)
+        PERROR_EXIT("wait4");
+    kill(-r->pid, SIGKILL);
+    if (usage.ru_maxrss > r->peak_rss_kb)
+        r->peak_rss_kb = usage.ru_maxrss;
+    if (!r->status) {
+        if (r->killed)
+            r->status = "killed";
+        else if (WIFSIGNALED(status) && !(r->interrupted && WTERMSIG(status) == SIGINT))
+            r->status = "crashed";
+        else if (!r->solution_count)
+            r->status = "no solution";
+        else
+            r->status = "ok";
+    }
+    if (!r->solution_count)
+        r->score = r->best_score = 0;
+    fprintf(stderr, "%s #%ld: %s, score %ld, best %ld, first %.2f s, best %.2f s, peak %ld kB\n",
+        r->map_path, r->index, r->status, r->score, r->best_score, r->first_time, r->best_time, r->peak_rss_kb);
+    h->slot[slot] = NULL;
+    h->running_count--;
+}
+
+// Sends SIGINT at the time limit and SIGKILL once the grace time is over, or
+// at once if the lifter goes over the memory limit.
+void check_limits(struct harness *h, struct run *r, double now) {
+    long rss_kb = get_rss_kb(h, r->pid);
+    if (rss_kb > r->peak_rss_kb)
+        r->peak_rss_kb = rss_kb;
+    if (!r->killed && h->memory_limit_kb && rss_kb > h->memory_limit_kb) {
+        r->status = "out of memory";
+        r->killed = true;
+        kill(-r->pid, SIGKILL);
+    } else if (!r->killed && now >= r->kill_time) {
+        r->killed = true;
+        kill(-r->pid, SIGKILL);
+    } else if (!r->interrupted && now >= r->interrupt_time) {
+        r->interrupted = true;
+        kill(-r->pid, SIGINT);
+    }
+}
+
+void run_all(struct harness *h) {
+    struct pollfd *fds;
+    long *fd_slot, fd_count, i;
+    double now;
+    if (!(h->slot = calloc(h->slot_count, sizeof(struct run *))) ||
+        !(fds = malloc(h->slot_count * sizeof(struct pollfd))) ||
+        !(fd_slot = malloc(h->slot_count * sizeof(long))))
+        PERROR_EXIT("malloc");
+    while (h->next_run < h->run_count || h->running_count) {
+        for (i = 0; i < h->slot_count && h->next_run < h->run_count; i++)
+            if (!h->slot[i])
+                start_run(h, &h->run[h->next_run++], i);
+        fd_count = 0;
+        for (i = 0; i < h->slot_count; i++) {
+            if (h->slot[i] && h->slot[i]->fd >= 0) {
+                fds[fd_count].fd = h->slot[i]->fd;
+                fds[fd_count].events = POLLIN;
+                fd_slot[fd_count++] = i;
+            }
+        }
+        if (poll(fds, fd_count, POLL_INTERVAL_MS) < 0 && errno != EINTR)
+            PERROR_EXIT("poll");
+        now = get_time();
+        for (i = 0; i < fd_count; i++)
+            if (fds[i].revents)
+                read_output(h->slot[fd_slot[i]], now);
+        for (i = 0; i < h->slot_count; i++) {
+            if (!h->slot[i])
+                continue;
+            if (h->slot[i]->fd < 0)
+                finish_run(h, h->slot[i], i);
+            else
+                check_limits(h, h->slot[i], now);
+        }
+    }
+    free(fds);
+    free(fd_slot);
+    free(h->slot);
+}
+
+
+void print_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+void print_json(const struct harness *h, FILE *f) {
+    const struct run *r;
+    long i;
+    fprintf(f, "[\n");
+    for (i = 0; i < h->run_count; i++) {
+        r = &h->run[i];
+        fprintf(f, "  {\"map\": ");
+        print_json_string(f, r->map_path);
+        fprintf(f, ", \"run\": %ld, \"status\": ", r->index);
+        print_json_string(f, r->status);
+        fprintf(f, ", \"score\": %ld, \"best_score\": %ld, \"solution_count\": %ld, \"invalid_count\": %ld",
+            r->score, r->best_score, r->solution_count, r->invalid_count);
+        if (r->solution_count)
+            fprintf(f, ", \"time_to_first\": %.3f, \"time_to_best\": %.3f", r->first_time, r->best_time);
+        else
+            fprintf(f, ", \"time_to_first\": null, \"time_to_best\": null");
+        fprintf(f, ", \"peak_rss_kb\": %ld, \"cpu\": %ld, \"moves\": ", r->peak_rss_kb, r->cpu);
+        print_json_string(f, r->moves ? r->moves : "");
+        fprintf(f, "}%s\n", i + 1 < h->run_count ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+
+int main(int argc, char **argv) {
+    struct harness h;
+    struct state **s0;
+    char **map_path = NULL;
+    const char *output_path = NULL;
+    FILE *output;
+    long map_count = 0, repeat_count = 1, i, j;
+    memset(&h, 0, sizeof(h));
+    h.time_limit = DEFAULT_TIME_LIMIT;
+    h.grace_time = DEFAULT_GRACE_TIME;
+    h.memory_limit_kb = DEFAULT_MEMORY_MB * 1024;
+    h.cpu_count = count_online_cpus();
+    h.slot_count = h.cpu_count;
+    h.page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            h.slot_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            h.time_limit = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+            h.grace_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            h.memory_limit_kb = atol(argv[++i]) * 1024;
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            repeat_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output_path = argv[++i];
+        else if (argv[i][0] == '-')
+            break;
+        else if (!h.lifter)
+            h.lifter = argv[i];
+        else {
+            if (!(map_path = realloc(map_path, (map_count + 1) * sizeof(char *))))
+                PERROR_EXIT("realloc");
+            map_path[map_count++] = argv[i];
+        }
+    }
+    if (i < argc || !h.lifter || h.slot_count < 1 || repeat_count < 1)
+        LOG_EXIT("Usage: %s [-j <jobs>] [-t <seconds>] [-g <seconds>] [-m <megabytes>] [-n <runs>] [-o <json>] <lifter> [<map>...]\n", argv[0]);
+    if (!map_count)
+        map_path = list_maps("../../tests", &map_count);
+    if (!(s0 = malloc(map_count * sizeof(struct state *))) ||
+        !(h.run = calloc(map_count * repeat_count, sizeof(struct run))))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < map_count; i++)
+        s0[i] = new_from_file(map_path[i]);
+    for (j = 0; j < repeat_count; j++) {
+        for (i = 0; i < map_count; i++) {
+            h.run[h.run_count].map_path = map_path[i];
+            h.run[h.run_count].s0 = s0[i];
+            h.run[h.run_count].index = j;
+            h.run[h.run_count].fd = -1;
+            h.run_count++;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    run_all(&h);
+    if (!output_path)
+        print_json(&h, stdout);
+    else {
+        if (!(output = fopen(output_path, "w")))
+            PERROR_EXIT(output_path);
+        print_json(&h, output);
+        fclose(output);
+    }
+    return 0;
+}
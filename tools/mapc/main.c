@@ -0,0 +1,20 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libvm.h"
+#include "binmap.h"
+
+
+int main(int argc, char **argv) {
+    struct state *s;
+    if (argc != 3)
+        LOG_EXIT("Usage: %s <map> <compiled-map>\n", argv[0]);
+    s = new_from_file(argv[1]);
+    save_binary_map(s, argv[2]);
+    free(s);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "optimize.h"
+
+
+int main(int argc, char **argv) {
+    const char *map_path = NULL, *moves_path = NULL;
+    char *moves = NULL, *optimized;
+    size_t moves_size = 0;
+    long thread_count = 0, candidate_count, i;
+    double time_limit = 10;
+    struct state *s0, *s;
+    FILE *f = stdin;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            thread_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            time_limit = atof(argv[++i]);
+        else if (argv[i][0] == '-' || moves_path)
+            LOG_EXIT("Usage: %s [-j <thread-count>] [-t <seconds>] <map> [<moves>]\n", argv[0]);
+        else if (map_path)
+            moves_path = argv[i];
+        else
+            map_path = argv[i];
+    }
+    if (!map_path)
+        LOG_EXIT("Usage: %s [-j <thread-count>] [-t <seconds>] <map> [<moves>]\n", argv[0]);
+    s0 = new_from_file(map_path);
+    if (moves_path && !(f = fopen(moves_path, "r")))
+        PERROR_EXIT(moves_path);
+    if (getline(&moves, &moves_size, f) == -1)
+        LOG_EXIT("%s: no moves\n", moves_path ? moves_path : "stdin");
+    s = make_moves(s0, moves);
+    LOG("from %ld in %ld moves\n", get_score(s), get_move_count(s));
+    free(s);
+    optimized = optimize(s0, moves, thread_count, time_limit, &candidate_count);
+    s = make_moves(s0, optimized);
+    LOG("to %ld in %ld moves, after %ld candidates\n", get_score(s), get_move_count(s), candidate_count);
+    printf("%s\n", optimized);
+    free(s);
+    free(optimized);
+    free(moves);
+    free(s0);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libvm.h"
+#include "table.h"
+#include "search.h"
+
+
+#define DEFAULT_NODE_COUNT 200000
+
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char **argv) {
+    struct state *s0, *s;
+    char *moves;
+    long max_thread_count, node_count, expanded_count, thread_count;
+    double start, elapsed, rate, base = 0;
+    if (argc < 2 || argc > 4)
+        LOG_EXIT("usage: %s <map> [<max-thread-count> [<node-count>]]\n", argv[0]);
+    s0 = new_from_file(argv[1]);
+    max_thread_count = argc > 2 ? atol(argv[2]) : count_online_cpus();
+    node_count = argc > 3 ? atol(argv[3]) : DEFAULT_NODE_COUNT;
+    for (thread_count = 1; thread_count <= max_thread_count; thread_count++) {
+        start = get_time();
+        moves = search(s0, thread_count, node_count, &expanded_count);
+        elapsed = get_time() - start;
+        s = make_moves(s0, moves);
+        rate = expanded_count / elapsed;
+        if (thread_count == 1)
+            base = rate;
+        printf("threads %3ld  %8ld nodes  %8.3f s  %10.0f nodes/s  speedup %5.2f  score %ld\n", thread_count, expanded_count, elapsed, rate, rate / base, get_score(s));
+        free(s);
+        free(moves);
+    }
+    free(s0);
+    return 0;
+}
@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libvm.h"
+#include "cache.h"
+#include "optimize.h"
+#include "search.h"
+
+
+// Cores are handed out again whenever a slice ends, so no map holds more
+// than its share for longer than this.
+#define SLICE_SECONDS 5.0
+
+// A map is done after this many slices in a row that find nothing better.
+#define MAX_STALE_SLICE_COUNT 2
+
+// Each lambda counts as this many cells when sharing out time.
+#define LAMBDA_WEIGHT 20
+
+// A rough rate for one search thread on a mid-sized map, as in
+// tools/lifter-server.
+#define SEARCH_NODES_PER_SECOND 50000
+
+
+struct map_job {
+    const char *path;
+    struct state *s0;
+    long score_bound;
+    double weight;
+    char *best_moves;
+    long best_score;
+    long thread_count;
+    long slice_count;
+    long stale_count;
+    double cpu_time;
+    bool done;
+};
+
+struct driver {
+    pthread_mutex_t mutex;
+    pthread_cond_t slice_cond;
+    struct map_job *job;
+    long job_count;
+    long core_count;
+    long free_core_count;
+    double deadline;
+};
+
+struct slice {
+    struct driver *d;
+    struct map_job *j;
+    long thread_count;
+    double time_limit;
+};
+
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Time per move grows with the size of the map, and the room to improve with
+// the number of lambdas.
+double get_weight(const struct state *s0) {
+    long w, h;
+    get_world_size(s0, &w, &h);
+    return w * h + LAMBDA_WEIGHT * get_lambda_count(s0);
+}
+
+
+// The first slice of a map searches for half its time, and every slice
+// optimizes the best moves known for the rest.
+void *run_slice(void *arg) {
+    struct slice *sl = arg;
+    struct driver *d = sl->d;
+    struct map_job *j = sl->j;
+    struct state *s;
+    char *moves, *best_moves;
+    long best_score, score;
+    double start = get_time(), left;
+    pthread_mutex_lock(&d->mutex);
+    if (!(best_moves = strdup(j->best_moves)))
+        PERROR_EXIT("strdup");
+    best_score = j->best_score;
+    pthread_mutex_unlock(&d->mutex);
+    if (!j->slice_count) {
+        moves = search(j->s0, sl->thread_count, sl->time_limit / 2 * SEARCH_NODES_PER_SECOND * sl->thread_count, NULL);
+        s = make_moves(j->s0, moves);
+        if ((score = get_score(s)) > best_score) {
+            free(best_moves);
+            best_moves = moves;
+            best_score = score;
+        } else
+            free(moves);
+        free(s);
+    }
+    if ((left = sl->time_limit - (get_time() - start)) > 0) {
+        moves = optimize(j->s0, best_moves, sl->thread_count, left, NULL);
+        s = make_moves(j->s0, moves);
+        if ((score = get_score(s)) > best_score) {
+            free(best_moves);
+            best_moves = moves;
+            best_score = score;
+        } else
+            free(moves);
+        free(s);
+    }
+    pthread_mutex_lock(&d->mutex);
+    if (best_score > j->best_score) {
+        free(j->best_moves);
+        j->best_moves = best_moves;
+        j->best_score = best_score;
+        j->stale_count = 0;
+        best_moves = NULL;
+    } else
+        j->stale_count++;
+    j->slice_count++;
+    j->cpu_time += sl->thread_count * (get_time() - start);
+    j->done = j->stale_count >= MAX_STALE_SLICE_COUNT || j->best_score >= j->score_bound;
+    j->thread_count = 0;
+    d->free_core_count += sl->thread_count;
+    LOG("%s: %ld after %ld slices, %.1f cpu s%s\n", j->path, j->best_score, j->slice_count, j->cpu_time, j->done ? ", done" : "");
+    pthread_cond_signal(&d->slice_cond);
+    pthread_mutex_unlock(&d->mutex);
+    if (best_moves)
+        save_solution(j->s0, best_moves, "solve-all");
+    free(best_moves);
+    free(sl);
+    return NULL;
+}
+
+// Called with the mutex held.  Picks the idle map furthest behind its share
+// of the time, and gives it its share of the cores and of the time left,
+// counting only maps that are not done, so that cores freed by finished maps
+// go to the rest.
+bool start_slice(struct driver *d, double now) {
+    struct map_job *j, *next = NULL;
+    struct slice *sl;
+    pthread_t thread;
+    double active_weight = 0;
+    long thread_count, i;
+    if (!d->free_core_count || now >= d->deadline)
+        return false;
+    for (i = 0; i < d->job_count; i++) {
+        j = &d->job[i];
+        if (j->done)
+            continue;
+        active_weight += j->weight;
+        if (!j->thread_count && (!next || j->cpu_time / j->weight < next->cpu_time / next->weight))
+            next = j;
+    }
+    if (!next)
+        return false;
+    thread_count = (long)(d->core_count * next->weight / active_weight + 0.5);
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > d->free_core_count)
+        thread_count = d->free_core_count;
+    if (!(sl = malloc(sizeof(struct slice))))
+        PERROR_EXIT("malloc");
+    sl->d = d;
+    sl->j = next;
+    sl->thread_count = thread_count;
+    sl->time_limit = d->core_count * (d->deadline - now) * next->weight / active_weight / thread_count;
+    if (sl->time_limit > d->deadline - now)
+        sl->time_limit = d->deadline - now;
+    if (sl->time_limit > SLICE_SECONDS)
+        sl->time_limit = SLICE_SECONDS;
+    next->thread_count = thread_count;
+    d->free_core_count -= thread_count;
+    if (pthread_create(&thread, NULL, run_slice, sl) || pthread_detach(thread))
+        PERROR_EXIT("pthread_create");
+    return true;
+}
+
+void write_results(const struct driver *d, const char *path) {
+    FILE *f;
+    long total_score = 0, i;
+    if (!(f = fopen(path, "w")))
+        PERROR_EXIT(path);
+    for (i = 0; i < d->job_count; i++) {
+        fprintf(f, "%s %ld %s\n", d->job[i].path, d->job[i].best_score, d->job[i].best_moves);
+        total_score += d->job[i].best_score;
+    }
+    if (fclose(f))
+        PERROR_EXIT("fclose");
+    printf("%ld maps, total score %ld\n", d->job_count, total_score);
+}
+
+
+int main(int argc, char **argv) {
+    const char *results_path = "results";
+    struct driver d;
+    struct map_job *j;
+    struct state *s;
+    double time_limit = 60, now;
+    long i;
+    memset(&d, 0, sizeof(struct driver));
+    d.core_count = count_online_cpus();
+    if (!(d.job = calloc(argc, sizeof(struct map_job))))
+        PERROR_EXIT("calloc");
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            d.core_count = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            time_limit = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            results_path = argv[++i];
+        else if (argv[i][0] == '-')
+            LOG_EXIT("Usage: %s [-j <core-count>] [-t <seconds>] [-o <results>] <map>...\n", argv[0]);
+        else
+            d.job[d.job_count++].path = argv[i];
+    }
+    if (!d.job_count)
+        LOG_EXIT("Usage: %s [-j <core-count>] [-t <seconds>] [-o <results>] <map>...\n", argv[0]);
+    if (d.core_count < 1)
+        d.core_count = 1;
+    d.free_core_count = d.core_count;
+    d.deadline = get_time() + time_limit;
+    for (i = 0; i < d.job_count; i++) {
+        j = &d.job[i];
+        j->s0 = new_from_file(j->path);
+        j->score_bound = get_score_bound(j->s0);
+        j->weight = get_weight(j->s0);
+        if (!(j->best_moves = load_solution(j->s0, &j->best_score)) && !(j->best_moves = strdup("")))
+            PERROR_EXIT("strdup");
+        s = make_moves(j->s0, j->best_moves);
+        j->best_score = get_score(s);
+        j->done = j->best_score >= j->score_bound;
+        free(s);
+    }
+    pthread_mutex_init(&d.mutex, NULL);
+    pthread_cond_init(&d.slice_cond, NULL);
+    pthread_mutex_lock(&d.mutex);
+    while (true) {
+        now = get_time();
+        while (start_slice(&d, now))
+            ;
+        if (d.free_core_count == d.core_count)
+            break;
+        pthread_cond_wait(&d.slice_cond, &d.mutex);
+    }
+    pthread_mutex_unlock(&d.mutex);
+    write_results(&d, results_path);
+    for (i = 0; i < d.job_count; i++) {
+        free(d.job[i].best_moves);
+        free(d.job[i].s0);
+    }
+    free(d.job);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libvm.h"
+#include "table.h"
+
+
+#define STRESS_LOG_BUCKET_COUNT 12
+#define STRESS_ROUND_COUNT 64
+#define EVICTION_LOG_BUCKET_COUNT 8
+#define EVICTION_OP_COUNT 4000000
+#define BENCH_LOG_BUCKET_COUNT 20
+#define BENCH_OP_COUNT 4000000
+
+struct worker {
+    pthread_t thread;
+    struct table *t;
+    long id;
+    long op_count;
+    long *best_score;
+    long failure_count;
+};
+
+
+unsigned long next_random(unsigned long *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+// The move count stored with each score is derived from the key and the
+// score, so that an entry mixing two writes can be told apart.
+long get_check_move_count(unsigned long key, long score) {
+    return ((key >> 7) ^ (unsigned long)score * 2654435761UL) & MAX_TABLE_MOVE_COUNT;
+}
+
+// Key i lives in bucket i / TABLE_BUCKET_SIZE, so no bucket ever overflows.
+unsigned long get_exact_key(long i) {
+    return (unsigned long)(i % TABLE_BUCKET_SIZE + 1) << (sizeof(unsigned long) * CHAR_BIT - TABLE_TAG_BITS + 1) | (unsigned long)(i / TABLE_BUCKET_SIZE);
+}
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+void *run_exact_worker(void *arg) {
+    struct worker *w = arg;
+    unsigned long seed = 88172645463325252UL + w->id;
+    long key_count, round, i, score, best;
+    key_count = (1L << STRESS_LOG_BUCKET_COUNT) * TABLE_BUCKET_SIZE;
+    for (round = 0; round < STRESS_ROUND_COUNT; round++) {
+        for (i = 0; i < key_count; i++) {
+            score = (long)(next_random(&seed) % 2000000) - 1000000;
+            record_in_table(w->t, get_exact_key(i), score, get_check_move_count(get_exact_key(i), score));
+            best = __atomic_load_n(&w->best_score[i], __ATOMIC_RELAXED);
+            while (score > best && !__atomic_compare_exchange_n(&w->best_score[i], &best, score, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+        }
+    }
+    return NULL;
+}
+
+void *run_eviction_worker(void *arg) {
+    struct worker *w = arg;
+    unsigned long seed = 88172645463325252UL + w->id, key;
+    long i, score, move_count;
+    for (i = 0; i < w->op_count; i++) {
+        key = next_random(&seed) % 100000 * 0x9E3779B97F4A7C15UL;
+        score = (long)(next_random(&seed) % 2000000) - 1000000;
+        record_in_table(w->t, key, score, get_check_move_count(key, score));
+        if (probe_table(w->t, key, &score, &move_count) && move_count != get_check_move_count(key, score))
+            w->failure_count++;
+    }
+    return NULL;
+}
+
+void *run_bench_worker(void *arg) {
+    struct worker *w = arg;
+    unsigned long seed = 88172645463325252UL + w->id, key;
+    long i;
+    for (i = 0; i < w->op_count; i++) {
+        key = next_random(&seed) % (4L << BENCH_LOG_BUCKET_COUNT) * 0x9E3779B97F4A7C15UL;
+        record_in_table(w->t, key, (long)(next_random(&seed) % 1000), i & MAX_TABLE_MOVE_COUNT);
+    }
+    return NULL;
+}
+
+void run_workers(struct worker *w, long thread_count, void *(*run)(void *)) {
+    long i;
+    for (i = 0; i < thread_count; i++)
+        if (pthread_create(&w[i].thread, NULL, run, &w[i]))
+            PERROR_EXIT("pthread_create");
+    for (i = 0; i < thread_count; i++)
+        pthread_join(w[i].thread, NULL);
+}
+
+
+bool stress(long thread_count, char policy) {
+    struct worker w[thread_count];
+    struct table *t;
+    long *best_score, key_count, failure_count, score, move_count, i;
+    key_count = (1L << STRESS_LOG_BUCKET_COUNT) * TABLE_BUCKET_SIZE;
+    if (!(best_score = malloc(key_count * sizeof(long))))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < key_count; i++)
+        best_score[i] = LONG_MIN;
+    t = new_table(STRESS_LOG_BUCKET_COUNT, policy);
+    memset(w, 0, sizeof(w));
+    for (i = 0; i < thread_count; i++) {
+        w[i].t = t;
+        w[i].id = i;
+        w[i].best_score = best_score;
+    }
+    run_workers(w, thread_count, run_exact_worker);
+    failure_count = 0;
+    for (i = 0; i < key_count; i++) {
+        if (!probe_table(t, get_exact_key(i), &score, &move_count) || score != best_score[i] || move_count != get_check_move_count(get_exact_key(i), score)) {
+            if (!failure_count)
+                LOG("key %ld: expected score %ld, found %ld\n", i, best_score[i], score);
+            failure_count++;
+        }
+    }
+    LOG("policy %c: %ld threads, %ld keys, %ld wrong best scores\n", policy, thread_count, key_count, failure_count);
+    free(t);
+    free(best_score);
+    if (failure_count)
+        return false;
+    t = new_table(EVICTION_LOG_BUCKET_COUNT, policy);
+    for (i = 0; i < thread_count; i++) {
+        w[i].t = t;
+        w[i].op_count = EVICTION_OP_COUNT / thread_count;
+    }
+    run_workers(w, thread_count, run_eviction_worker);
+    for (i = 0; i < thread_count; i++)
+        failure_count += w[i].failure_count;
+    LOG("policy %c: %ld threads, %d operations under eviction, %ld torn entries\n", policy, thread_count, EVICTION_OP_COUNT, failure_count);
+    free(t);
+    return !failure_count;
+}
+
+void bench(long max_thread_count, char policy) {
+    struct worker w[max_thread_count];
+    struct table *t;
+    long thread_count, i;
+    double start, base = 0, rate;
+    for (thread_count = 1; thread_count <= max_thread_count; thread_count++) {
+        t = new_table(BENCH_LOG_BUCKET_COUNT, policy);
+        memset(w, 0, sizeof(w));
+        for (i = 0; i < thread_count; i++) {
+            w[i].t = t;
+            w[i].id = i;
+            w[i].op_count = BENCH_OP_COUNT;
+        }
+        start = get_time();
+        run_workers(w, thread_count, run_bench_worker);
+        rate = thread_count * BENCH_OP_COUNT / (get_time() - start) / 1e6;
+        if (thread_count == 1)
+            base = rate;
+        printf("policy %c  threads %3ld  %8.2f Mops/s  speedup %5.2f\n", policy, thread_count, rate, rate / base);
+        free(t);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    long thread_count;
+    if (argc < 2 || argc > 3 || (strcmp(argv[1], "stress") && strcmp(argv[1], "bench")))
+        LOG_EXIT("usage: %s stress|bench [<thread-count>]\n", argv[0]);
+    thread_count = argc == 3 ? atol(argv[2]) : count_online_cpus();
+    if (thread_count < 1)
+        LOG_EXIT("thread count must be positive\n");
+    if (!strcmp(argv[1], "bench")) {
+        bench(thread_count, T_ALWAYS_REPLACE);
+        bench(thread_count, T_DEPTH_PREFERRED);
+        return 0;
+    }
+    if (!stress(thread_count, T_ALWAYS_REPLACE) || !stress(thread_count, T_DEPTH_PREFERRED))
+        return 1;
+    return 0;
+}
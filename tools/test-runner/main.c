@@ -0,0 +1,248 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libvm.h"
+
+
+#define GREEN "\033[32m"
+#define RED   "\033[31m"
+#define PLAIN "\033[0m"
+
+
+struct test_map {
+    char *name;
+    struct state *s0;
+};
+
+struct test_case {
+    const struct test_map *map;
+    char *name;
+    char *in_path, *out_path;
+    bool passed;
+    double time;
+    char *moves, *expected, *got;
+};
+
+struct runner {
+    struct test_case *test_case;
+    long test_case_count;
+    long next;
+};
+
+
+double get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+char *join_path(const char *dir, const char *name) {
+    char *path;
+    if (!(path = malloc(strlen(dir) + strlen(name) + 2)))
+        PERROR_EXIT("malloc");
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+char *read_file(const char *path) {
+    FILE *f;
+    char *buf;
+    long size;
+    if (!(f = fopen(path, "r")))
+        PERROR_EXIT(path);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    if (!(buf = malloc(size + 1)))
+        PERROR_EXIT("malloc");
+    if (fread(buf, 1, size, f) != (size_t)size)
+        PERROR_EXIT("fread");
+    buf[size] = 0;
+    fclose(f);
+    return buf;
+}
+
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Lists the entries of a directory in sorted order, as the shell glob in
+// runtests.sh does.
+char **list_dir(const char *dir, long *out_count) {
+    DIR *d;
+    struct dirent *e;
+    char **name = NULL;
+    long count = 0;
+    if (!(d = opendir(dir)))
+        PERROR_EXIT(dir);
+    while ((e = readdir(d))) {
+        if (e->d_name[0] == '.')
+            continue;
+        if (!(name = realloc(name, (count + 1) * sizeof(char *))) || !(name[count] = strdup(e->d_name)))
+            PERROR_EXIT("malloc");
+        count++;
+    }
+    closedir(d);
+    qsort(name, count, sizeof(char *), compare_names);
+    *out_count = count;
+    return name;
+}
+
+
+// Applies the filters of test.lib in place: trailing whitespace is stripped
+// from every line and blank lines are dropped, as diff -B ignores them.  When
+// is_output, trampolines and targets after the first line become T and t.
+void normalise(char *text, bool is_output) {
+    char *in = text, *out = text, *line;
+    long line_count = 0, n, i;
+    while (*in) {
+        line = in;
+        n = strcspn(line, "\n");
+        in += n + (line[n] == '\n');
+        while (n > 0 && (line[n - 1] == ' ' || line[n - 1] == '\t' || line[n - 1] == '\r'))
+            n--;
+        if (is_output && line_count++) {
+            for (i = 0; i < n; i++) {
+                if (is_valid_target(line[i]))
+                    line[i] = 't';
+                else if (is_valid_trampoline(line[i]))
+                    line[i] = 'T';
+            }
+        }
+        if (!n)
+            continue;
+        memmove(out, line, n);
+        out += n;
+        *out++ = '\n';
+    }
+    *out = 0;
+}
+
+void run_test_case(struct test_case *c) {
+    struct state *s;
+    double start;
+    c->moves = read_file(c->in_path);
+    c->expected = read_file(c->out_path);
+    start = get_time();
+    s = make_moves(c->map->s0, c->moves);
+    if (!(c->got = malloc(s->world_length + 32)))
+        PERROR_EXIT("malloc");
+    sprintf(c->got, "%ld\n%s", get_score(s), s->world);
+    c->time = get_time() - start;
+    free(s);
+    normalise(c->got, true);
+    normalise(c->expected, false);
+    c->passed = !strcmp(c->got, c->expected);
+}
+
+void *run_worker(void *arg) {
+    struct runner *r = arg;
+    long i;
+    while ((i = __sync_fetch_and_add(&r->next, 1)) < r->test_case_count)
+        run_test_case(&r->test_case[i]);
+    return NULL;
+}
+
+
+void load_tests(struct runner *r, const char *dir) {
+    char **map_name, **file_name, *map_dir, *map_path;
+    long map_count, file_count, i, j, n;
+    struct test_map *m;
+    struct test_case *c;
+    map_name = list_dir(dir, &map_count);
+    r->test_case = NULL;
+    r->test_case_count = 0;
+    for (i = 0; i < map_count; i++) {
+        map_dir = join_path(dir, map_name[i]);
+        map_path = join_path(map_dir, "map");
+        if (access(map_path, R_OK)) {
+            free(map_path);
+            free(map_dir);
+            continue;
+        }
+        if (!(m = malloc(sizeof(struct test_map))))
+            PERROR_EXIT("malloc");
+        m->name = map_name[i];
+        m->s0 = new_from_file(map_path);
+        file_name = list_dir(map_dir, &file_count);
+        for (j = 0; j < file_count; j++) {
+            n = strlen(file_name[j]);
+            if (n < 4 || strcmp(file_name[j] + n - 3, ".in"))
+                continue;
+            if (!(r->test_case = realloc(r->test_case, (r->test_case_count + 1) * sizeof(struct test_case))))
+                PERROR_EXIT("realloc");
+            c = &r->test_case[r->test_case_count++];
+            memset(c, 0, sizeof(struct test_case));
+            c->map = m;
+            c->name = strndup(file_name[j], n - 3);
+            c->in_path = join_path(map_dir, file_name[j]);
+            strcpy(file_name[j] + n - 3, ".out");
+            c->out_path = join_path(map_dir, file_name[j]);
+        }
+        free(map_path);
+        free(map_dir);
+    }
+}
+
+void report(const struct runner *r, bool colour, double time) {
+    const struct test_case *c;
+    long pass_count = 0, i;
+    for (i = 0; i < r->test_case_count; i++) {
+        c = &r->test_case[i];
+        if (c->passed) {
+            pass_count++;
+            printf("%s%s/%s ok%s %.3f ms\n", colour ? GREEN : "", c->map->name, c->name, colour ? PLAIN : "", c->time * 1e3);
+        } else {
+            printf("%s%s/%s failed!!!%s %.3f ms\n", colour ? RED : "", c->map->name, c->name, colour ? PLAIN : "", c->time * 1e3);
+            printf("Input:\n%s", c->moves);
+            printf("Expected output:\n%s", c->expected);
+            printf("Got:\n%s", c->got);
+        }
+    }
+    printf("%ld passed, %ld failed, %.3f s\n", pass_count, r->test_case_count - pass_count, time);
+}
+
+
+int main(int argc, char **argv) {
+    const char *dir = "../../unittests/tests";
+    struct runner r;
+    pthread_t *thread;
+    long thread_count, i;
+    double start;
+    thread_count = count_online_cpus();
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            thread_count = atol(argv[++i]);
+        else if (argv[i][0] == '-')
+            LOG_EXIT("Usage: %s [-j <thread-count>] [<tests-dir>]\n", argv[0]);
+        else
+            dir = argv[i];
+    }
+    if (thread_count < 1)
+        thread_count = 1;
+    start = get_time();
+    load_tests(&r, dir);
+    r.next = 0;
+    if (!(thread = malloc(thread_count * sizeof(pthread_t))))
+        PERROR_EXIT("malloc");
+    for (i = 0; i < thread_count; i++)
+        if (pthread_create(&thread[i], NULL, run_worker, &r))
+            PERROR_EXIT("pthread_create");
+    for (i = 0; i < thread_count; i++)
+        pthread_join(thread[i], NULL);
+    report(&r, isatty(STDOUT_FILENO), get_time() - start);
+    for (i = 0; i < r.test_case_count; i++)
+        if (!r.test_case[i].passed)
+            return 1;
+    return 0;
+}
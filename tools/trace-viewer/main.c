@@ -0,0 +1,35 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libvm.h"
+#include "trace.h"
+
+
+int main(int argc, char **argv) {
+    struct trace *t;
+    struct state *s;
+    char *end;
+    long n, i;
+    if (argc < 2)
+        LOG_EXIT("Usage: %s <trace> [<move-count>...]\n", argv[0]);
+    t = open_trace(argv[1]);
+    if (argc == 2) {
+        printf("%ld\n", get_trace_length(t) - 1);
+        return 0;
+    }
+    for (i = 2; i < argc; i++) {
+        n = strtol(argv[i], &end, 10);
+        if (*end || n < 0 || n >= get_trace_length(t))
+            LOG_EXIT("%s: no state after %s moves\n", argv[1], argv[i]);
+        s = read_trace_state(t, n);
+        dump(s);
+        free(s);
+    }
+    return 0;
+}
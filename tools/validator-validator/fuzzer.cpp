@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "vm.h"
+
+// Runs libvm and the engine in ../cpp-validator/engine.h side by side on
+// random and mutated move strings, comparing score, condition and world after
+// every move.  The first divergence found is cut down to the shortest prefix
+// that shows it, then to as few moves as possible, and printed.
+
+typedef engine::Engine<engine::VectorCells> Engine;
+typedef std::chrono::steady_clock Clock;
+
+static const char moveChars[] = "LRUDWS";
+static const unsigned int maxCorpusSize = 64;
+
+struct Map {
+  const char *path;
+  struct state *s0;
+  Engine e0;
+  int moveLimit;
+  std::mutex mutex;
+  std::vector<std::string> corpus;
+  int bestMoveCount, bestScore;
+};
+
+struct Divergence {
+  Map *map;
+  std::string moves;
+};
+
+static std::atomic<bool> stopped(false);
+static std::atomic<long> stepCount(0), runCount(0);
+static std::mutex divergenceMutex;
+static std::vector<Divergence> divergences;
+
+static bool same(const struct state *s, const Engine &e, std::vector<char> &world)
+{
+  long length;
+  const char *vmWorld = vm_get_world(s, &length);
+  if (vm_get_score(s) != e.score() || vm_get_condition(s) != e.condition())
+    return false;
+  e.writeWorld(world.data());
+  return length == (long) world.size() && !std::memcmp(vmWorld, world.data(), length);
+}
+
+// Replays moves on both engines.  Returns the number of moves after which
+// they first disagree, or -1 if they never do.
+static int diverge(const Map &m, const std::string &moves, int &outMoveCount, int &outScore)
+{
+  std::vector<char> world((m.e0.width() + 1) * m.e0.height());
+  struct state *s = vm_copy(m.s0), *scratch = vm_copy(m.s0);
+  Engine e = m.e0;
+  int result = -1;
+  for (unsigned int i = 0; i < moves.size() && e.condition() == engine::None; ++i) {
+    vm_apply_move(s, scratch, moves[i]);
+    e.step(moves[i]);
+    if (!same(s, e, world)) {
+      result = i + 1;
+      break;
+    }
+  }
+  stepCount += result == -1 ? e.moveCount() : result;
+  outMoveCount = e.moveCount();
+  outScore = e.score();
+  vm_free(s);
+  vm_free(scratch);
+  return result;
+}
+
+// Cuts the moves down to the first divergence, then drops runs of moves,
+// halving their length down to single moves, for as long as the engines still
+// disagree somewhere.
+static std::string minimise(const Map &m, std::string moves)
+{
+  int moveCount, score, n;
+  moves.resize(diverge(m, moves, moveCount, score));
+  for (unsigned int length = moves.size() / 2; length >= 1; length /= 2) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (unsigned int i = 0; i + length <= moves.size(); i += length) {
+        std::string shorter = moves;
+        shorter.erase(i, length);
+        if ((n = diverge(m, shorter, moveCount, score)) != -1) {
+          moves = shorter.substr(0, n);
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+  return moves;
+}
+
+static std::string randomMoves(std::mt19937 &random, int length)
+{
+  std::string moves(length, 0);
+  for (int i = 0; i < length; ++i)
+    moves[i] = moveChars[random() % (sizeof(moveChars) - 1)];
+  if (random() % 5 == 0)
+    moves += engine::MoveAbort;
+  return moves;
+}
+
+static std::string mutate(std::mt19937 &random, std::string moves, int moveLimit)
+{
+  int editCount = 1 + random() % 4;
+  for (int k = 0; k < editCount; ++k) {
+    int at = moves.empty() ? 0 : random() % moves.size();
+    char move = moveChars[random() % (sizeof(moveChars) - 1)];
+    switch (random() % 5) {
+    case 0:
+      if (!moves.empty())
+        moves[at] = move;
+      break;
+    case 1:
+      moves.insert(moves.begin() + at, move);
+      break;
+    case 2:
+      if (!moves.empty())
+        moves.erase(at, 1);
+      break;
+    case 3:
+      moves.insert(at, moves.substr(at, random() % 16));
+      break;
+    default:
+      moves = moves.substr(0, at) + randomMoves(random, random() % 32);
+    }
+  }
+  if ((int) moves.size() > moveLimit)
+    moves.resize(moveLimit);
+  return moves;
+}
+
+// Keeps move strings that went further or scored better than any before them
+// as seeds for mutation.
+static void record(Map &m, std::mt19937 &random, const std::string &moves, int moveCount, int score)
+{
+  std::lock_guard<std::mutex> lock(m.mutex);
+  if (moveCount <= m.bestMoveCount && score <= m.bestScore)
+    return;
+  m.bestMoveCount = std::max(m.bestMoveCount, moveCount);
+  m.bestScore = std::max(m.bestScore, score);
+  if (m.corpus.size() < maxCorpusSize)
+    m.corpus.push_back(moves);
+  else
+    m.corpus[random() % maxCorpusSize] = moves;
+}
+
+// Every move costs time in proportion to the size of the map, so maps are
+// picked with weights that give each the same share of time.
+static void fuzz(std::vector<Map *> &maps, unsigned int seed, Clock::time_point deadline)
+{
+  std::mt19937 random(seed);
+  std::vector<double> weights;
+  for (unsigned int i = 0; i < maps.size(); ++i)
+    weights.push_back(1.0 / maps[i]->moveLimit);
+  std::discrete_distribution<int> pick(weights.begin(), weights.end());
+  while (!stopped && Clock::now() < deadline) {
+    Map &m = *maps[pick(random)];
+    std::string moves;
+    {
+      std::lock_guard<std::mutex> lock(m.mutex);
+      if (!m.corpus.empty() && random() % 4)
+        moves = mutate(random, m.corpus[random() % m.corpus.size()], m.moveLimit);
+    }
+    if (moves.empty())
+      moves = randomMoves(random, random() % std::min(m.moveLimit, 300));
+    int moveCount, score;
+    runCount++;
+    if (diverge(m, moves, moveCount, score) != -1) {
+      std::lock_guard<std::mutex> lock(divergenceMutex);
+      Divergence d = {&m, moves};
+      divergences.push_back(d);
+      stopped = true;
+      return;
+    }
+    record(m, random, moves, moveCount, score);
+  }
+}
+
+static void report(const Divergence &d)
+{
+  const Map &m = *d.map;
+  std::string moves = minimise(m, d.moves);
+  struct state *s = vm_make_moves(m.s0, moves.c_str());
+  Engine e = m.e0;
+  e.replay(moves.c_str());
+  long length;
+  const char *world = vm_get_world(s, &length);
+  std::cout << "divergence on " << m.path << " after " << moves.size() << " moves: " << moves << std::endl;
+  std::cout << "libvm: " << vm_get_score(s) << ' ' << vm_get_condition(s) << std::endl;
+  std::cout.write(world, length);
+  std::cout << "engine: " << e.score() << ' ' << e.condition() << std::endl;
+  std::cout << e;
+  vm_free(s);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<Map *> maps;
+  int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  double seconds = 10;
+  unsigned int seed = std::random_device()();
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-j" && i + 1 < argc) {
+      threadCount = std::atoi(argv[++i]);
+    } else if (arg == "-t" && i + 1 < argc) {
+      seconds = std::atof(argv[++i]);
+    } else if (arg == "-s" && i + 1 < argc) {
+      seed = std::strtoul(argv[++i], 0, 10);
+    } else {
+      std::ifstream file(argv[i]);
+      if (file.fail()) {
+        std::cerr << "Could not open " << argv[i] << "." << std::endl;
+        return 2;
+      }
+      std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      Map *m = new Map;
+      m->path = argv[i];
+      m->s0 = vm_new_from_file(argv[i]);
+      m->e0.load(input);
+      m->moveLimit = m->e0.width() * m->e0.height() + 1;
+      m->bestMoveCount = m->bestScore = 0;
+      maps.push_back(m);
+    }
+  }
+  if (maps.empty() || threadCount < 1) {
+    std::cerr << "Usage: ./fuzzer [-j threads] [-t seconds] [-s seed] <map>..." << std::endl;
+    return 1;
+  }
+
+  std::cout << "fuzzing " << maps.size() << " maps with " << threadCount << " threads, seed " << seed << std::endl;
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline = start + std::chrono::microseconds((long) (seconds * 1e6));
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threadCount; ++i)
+    threads.push_back(std::thread(fuzz, std::ref(maps), seed + i, deadline));
+  for (int i = 0; i < threadCount; ++i)
+    threads[i].join();
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << runCount << " runs, " << stepCount << " moves, " << stepCount / elapsed / 1e6 << " Mmoves/s" << std::endl;
+
+  if (!divergences.empty()) {
+    report(divergences[0]);
+    return 1;
+  }
+  std::cout << "no divergence" << std::endl;
+  return 0;
+}